@@ -28,7 +28,10 @@
 #include "ff.h"
 
 
-#if _CODE_PAGE == 437
+#if FFS_SMALL
+#define _TBLDEF 1       /* ASCII only, no table needed */
+
+#elif _CODE_PAGE == 437
 #define _TBLDEF 1
 static
 const WCHAR Tbl[] = {   /*  CP437(0x80-0xFF) to Unicode conversion table */
@@ -498,6 +501,26 @@ const WCHAR Tbl[] = {   /*  CP1258(0x80-0xFF) to Unicode conversion table */
 #endif
 
 
+#if FFS_SMALL
+
+WCHAR ff_convert (  /* Converted character, Returns zero on error */
+    WCHAR   src,    /* Character code to be converted */
+    UINT    dir     /* 0: Unicode to OEMCP, 1: OEMCP to Unicode */
+)
+{
+    return (src < 0x80) ? src : 0;  /* ASCII maps to itself both ways */
+}
+
+
+WCHAR ff_wtoupper ( /* Upper converted character */
+    WCHAR chr       /* Input character */
+)
+{
+    return (chr >= 0x61 && chr <= 0x7A) ? chr - 0x20 : chr;
+}
+
+#else
+
 WCHAR ff_convert (  /* Converted character, Returns zero on error */
     WCHAR   src,    /* Character code to be converted */
     UINT    dir     /* 0: Unicode to OEMCP, 1: OEMCP to Unicode */
@@ -534,7 +557,12 @@ WCHAR ff_wtoupper ( /* Upper converted character */
     int i;
 
 
+    if (chr < 0x80)     /* ASCII: skip the table scan */
+        return (chr >= 0x61 && chr <= 0x7A) ? chr - 0x20 : chr;
+
     for (i = 0; tbl_lower[i] && chr != tbl_lower[i]; i++) ;
 
     return tbl_lower[i] ? tbl_upper[i] : chr;
 }
+
+#endif /* FFS_SMALL */
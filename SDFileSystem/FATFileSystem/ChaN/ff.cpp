@@ -337,7 +337,7 @@ typedef struct {
                 0xC0,0xC1,0xC2,0xC3,0xC4,0xC5,0xC6,0xC7,0xC8,0xC9,0xCA,0xCB,0xEC,0xCD,0xCE,0xCF,0xD0,0xD1,0xF2,0xD3,0xD4,0xD5,0xD6,0xF7,0xD8,0xD9,0xDA,0xDB,0xDC,0xDD,0xFE,0x9F}
 
 #elif _CODE_PAGE == 1   /* ASCII (for only non-LFN cfg) */
-#if _USE_LFN
+#if _USE_LFN && !FFS_SMALL
 #error Cannot use LFN feature without valid code page.
 #endif
 #define _DF1S   0
@@ -266,6 +266,11 @@ int ff_cre_syncobj (BYTE, _SYNC_t*);/* Create a sync object */
 int ff_req_grant (_SYNC_t);         /* Lock sync object */
 void ff_rel_grant (_SYNC_t);        /* Unlock sync object */
 int ff_del_syncobj (_SYNC_t);       /* Delete a sync object */
+void ffs_lock (void);               /* Lock FATFileSystem wrapper state */
+void ffs_unlock (void);             /* Unlock FATFileSystem wrapper state */
+#else
+#define ffs_lock()
+#define ffs_unlock()
 #endif
 
 
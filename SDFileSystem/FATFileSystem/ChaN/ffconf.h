@@ -11,6 +11,32 @@
 
 #define FFS_DBG     0
 
+#define FFS_MAX_PATH    64  /* Longest "N:/name" path FATFileSystem::open will build */
+#define FFS_MAX_FILES   4   /* Number of FATFileHandle objects in the static pool */
+#define FFS_LOOKUP_CACHE 4  /* Read-only directory lookups remembered by open (0:off) */
+
+#define FFS_SMALL   0   /* 0:Full code page tables or 1:Small footprint profile */
+/* FFS_SMALL=1 keeps long file names but limits names to 7-bit ASCII:
+/  _CODE_PAGE becomes 1, ccsbcs.cpp swaps the 128-entry OEM table and the
+/  ~230-entry case table for plain ASCII conversions, and _MAX_LFN drops to
+/  the longest name open() can take, which shrinks the static LFN buffer
+/  from 512 to 126 bytes.
+/
+/  Measured with gcc -Os -m32 over ff.cpp + ccsbcs.cpp (text+data / bss,
+/  and the f_open frame from -fstack-usage):
+/    FFS_SMALL 0:  15627 / 520, f_open  96
+/    FFS_SMALL 1:  14109 / 132, f_open  96
+/  With FFS_REENTRANT=1 the buffer lives on the stack instead, so BSS is 8
+/  in both profiles but every name lookup frame grows by the buffer: f_open
+/  takes 608 bytes of stack with FFS_SMALL 0 and 224 with FFS_SMALL 1.
+/  Non-ASCII names on the card are still listed, by their 8.3 short name. */
+
+#define FFS_REENTRANT   0   /* 0:Single thread or 1:FatFs shared between threads */
+/* FFS_REENTRANT=1 turns on _FS_REENTRANT with the sync functions in
+/  syscall.cpp (pthreads on a Linux host, CMSIS-RTOS mutexes on the target,
+/  which needs the mbed-rtos library), guards the FATFileHandle pool and open
+/  lookup cache, and moves the LFN buffer to the stack as FatFs requires. */
+
 /*---------------------------------------------------------------------------/
 / Functions and Buffer Configurations
 /----------------------------------------------------------------------------*/
@@ -58,7 +84,11 @@
 / Locale and Namespace Configurations
 /----------------------------------------------------------------------------*/
 
+#if FFS_SMALL
+#define _CODE_PAGE  1
+#else
 #define _CODE_PAGE  858
+#endif
 /* The _CODE_PAGE specifies the OEM code page to be used on the target system.
 /  Incorrect setting of the code page can cause a file open failure.
 /
@@ -87,12 +117,20 @@
 /   857  - Turkish (OEM)
 /   862  - Hebrew (OEM)
 /   874  - Thai (OEM, Windows)
-/   1    - ASCII only (Valid for non LFN cfg.)
+/   1    - ASCII only (Valid for non LFN cfg, or LFN with FFS_SMALL.)
 */
 
 
+#if FFS_REENTRANT
+#define _USE_LFN    2       /* 0 to 3 */
+#else
 #define _USE_LFN    1       /* 0 to 3 */
+#endif
+#if FFS_SMALL
+#define _MAX_LFN    (FFS_MAX_PATH - 2)  /* Room for the longest open() name */
+#else
 #define _MAX_LFN    255     /* Maximum LFN length to handle (12 to 255) */
+#endif
 /* The _USE_LFN option switches the LFN support.
 /
 /   0: Disable LFN feature. _MAX_LFN and _LFN_UNICODE have no effect.
@@ -171,9 +209,9 @@
 /* A header file that defines sync object types on the O/S, such as
 /  windows.h, ucos_ii.h and semphr.h, must be included prior to ff.h. */
 
-#define _FS_REENTRANT   0       /* 0:Disable or 1:Enable */
-#define _FS_TIMEOUT     1000    /* Timeout period in unit of time ticks */
-#define _SYNC_t         HANDLE  /* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
+#define _FS_REENTRANT   FFS_REENTRANT   /* 0:Disable or 1:Enable */
+#define _FS_TIMEOUT     1000    /* Timeout period in unit of time ticks (ms) */
+#define _SYNC_t         void*   /* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
 
 /* The _FS_REENTRANT option switches the reentrancy (thread safe) of the FatFs module.
 /
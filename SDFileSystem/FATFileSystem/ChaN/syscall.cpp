@@ -0,0 +1,160 @@
+/*------------------------------------------------------------------------*/
+/* Sample code of OS dependent controls for FatFs                         */
+/* (C)ChaN, 2012 - adapted for pthreads and CMSIS-RTOS                    */
+/*------------------------------------------------------------------------*/
+
+#include "ff.h"
+
+
+#if _FS_REENTRANT
+
+/* One recursive mutex per volume, plus one guarding the FATFileSystem
+/  wrapper state (file handle pool, open lookup cache). Recursive so that
+/  FATFileSystem::open can hold the volume while FatFs takes it again. */
+
+#if defined(__linux__)  /* Host build: POSIX threads */
+
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t Mutex[_VOLUMES + 1];
+
+static
+int create_mutex (pthread_mutex_t *m)
+{
+    pthread_mutexattr_t attr;
+    int ret;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    ret = pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ret == 0;
+}
+
+int ff_cre_syncobj (    /* !=0:Function succeeded, ==0:Could not create due to any error */
+    BYTE vol,           /* Corresponding logical drive being processed */
+    _SYNC_t *sobj       /* Pointer to return the created sync object */
+)
+{
+    if (!create_mutex(&Mutex[vol])) return 0;
+    *sobj = &Mutex[vol];
+    return 1;
+}
+
+int ff_del_syncobj (    /* !=0:Function succeeded, ==0:Could not delete due to any error */
+    _SYNC_t sobj        /* Sync object tied to the logical drive to be deleted */
+)
+{
+    return pthread_mutex_destroy((pthread_mutex_t*)sobj) == 0;
+}
+
+int ff_req_grant (      /* TRUE:Got a grant to access the volume, FALSE:Could not get a grant */
+    _SYNC_t sobj        /* Sync object to wait */
+)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += _FS_TIMEOUT / 1000;
+    ts.tv_nsec += (_FS_TIMEOUT % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_mutex_timedlock((pthread_mutex_t*)sobj, &ts) == 0;
+}
+
+void ff_rel_grant (
+    _SYNC_t sobj        /* Sync object to be signaled */
+)
+{
+    pthread_mutex_unlock((pthread_mutex_t*)sobj);
+}
+
+static pthread_once_t WrapperOnce = PTHREAD_ONCE_INIT;
+
+static
+void create_wrapper_mutex (void)
+{
+    create_mutex(&Mutex[_VOLUMES]);
+}
+
+void ffs_lock (void)
+{
+    pthread_once(&WrapperOnce, create_wrapper_mutex);
+    pthread_mutex_lock(&Mutex[_VOLUMES]);
+}
+
+void ffs_unlock (void)
+{
+    pthread_mutex_unlock(&Mutex[_VOLUMES]);
+}
+
+#else                   /* Target build: CMSIS-RTOS from the mbed-rtos library */
+
+#include "cmsis_os.h"
+
+static uint32_t MutexCb[_VOLUMES + 1][4];   /* RTX mutex control blocks (recursive) */
+static osMutexId MutexId[_VOLUMES + 1];
+static const osMutexDef_t MutexDef[_VOLUMES + 1] = {
+    { MutexCb[0] },
+#if _VOLUMES > 1
+    { MutexCb[1] },
+#endif
+#if _VOLUMES > 2
+    { MutexCb[2] },
+#endif
+#if _VOLUMES > 3
+#error Add MutexDef entries for more volumes.
+#endif
+    { MutexCb[_VOLUMES] }
+};
+
+int ff_cre_syncobj (    /* !=0:Function succeeded, ==0:Could not create due to any error */
+    BYTE vol,           /* Corresponding logical drive being processed */
+    _SYNC_t *sobj       /* Pointer to return the created sync object */
+)
+{
+    /* Volumes are mounted from the FATFileSystem constructor, before any
+    /  thread can touch the wrapper, so its mutex is created here too. */
+    if (!MutexId[_VOLUMES]) MutexId[_VOLUMES] = osMutexCreate(&MutexDef[_VOLUMES]);
+    MutexId[vol] = osMutexCreate(&MutexDef[vol]);
+    *sobj = (_SYNC_t)MutexId[vol];
+    return MutexId[vol] != NULL;
+}
+
+int ff_del_syncobj (    /* !=0:Function succeeded, ==0:Could not delete due to any error */
+    _SYNC_t sobj        /* Sync object tied to the logical drive to be deleted */
+)
+{
+    return osMutexDelete((osMutexId)sobj) == osOK;
+}
+
+int ff_req_grant (      /* TRUE:Got a grant to access the volume, FALSE:Could not get a grant */
+    _SYNC_t sobj        /* Sync object to wait */
+)
+{
+    return osMutexWait((osMutexId)sobj, _FS_TIMEOUT) == osOK;
+}
+
+void ff_rel_grant (
+    _SYNC_t sobj        /* Sync object to be signaled */
+)
+{
+    osMutexRelease((osMutexId)sobj);
+}
+
+void ffs_lock (void)
+{
+    osMutexWait(MutexId[_VOLUMES], osWaitForever);
+}
+
+void ffs_unlock (void)
+{
+    osMutexRelease(MutexId[_VOLUMES]);
+}
+
+#endif /* __linux__ */
+
+#endif /* _FS_REENTRANT */
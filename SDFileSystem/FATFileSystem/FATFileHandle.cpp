@@ -24,12 +24,58 @@
 #include "mbed_debug.h"
 
 #include "FATFileHandle.h"
+#include "FATFileSystem.h"
+
+// Backing store for every FATFileHandle. Sized in 64-bit words so each slot
+// is suitably aligned for the object placed in it.
+#define FFS_HANDLE_WORDS ((sizeof(FATFileHandle) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+static uint64_t _handle_pool[FFS_MAX_FILES][FFS_HANDLE_WORDS];
+static bool _handle_used[FFS_MAX_FILES];
+
+void *FATFileHandle::operator new(size_t size) throw() {
+    if (size > sizeof(_handle_pool[0])) {
+        debug_if(FFS_DBG, "FATFileHandle of %d bytes overflows a pool slot\n", (int)size);
+        return NULL;
+    }
+    ffs_lock();
+    for (int i = 0; i < FFS_MAX_FILES; i++) {
+        if (!_handle_used[i]) {
+            _handle_used[i] = true;
+            ffs_unlock();
+            return _handle_pool[i];
+        }
+    }
+    ffs_unlock();
+    debug_if(FFS_DBG, "FATFileHandle pool exhausted (%d open)\n", FFS_MAX_FILES);
+    return NULL;
+}
+
+void FATFileHandle::operator delete(void *p) {
+    ffs_lock();
+    for (int i = 0; i < FFS_MAX_FILES; i++) {
+        if (p == _handle_pool[i]) {
+            _handle_used[i] = false;
+            break;
+        }
+    }
+    ffs_unlock();
+}
+
+FATFileHandle::FATFileHandle() {
+    _fh.fs = 0;
+}
 
 FATFileHandle::FATFileHandle(FIL fh) {
     _fh = fh;
 }
 
 int FATFileHandle::close() {
+    // A writer may have moved the file's clusters or size, so any lookup
+    // cached by the owning file system can no longer be trusted.
+    if (_fh.fs && (_fh.flag & FA_WRITE)) {
+        FATFileSystem *ffs = FATFileSystem::_ffs[_fh.fs->drv];
+        if (ffs) ffs->flush_lookup_cache();
+    }
     int retval = f_close(&_fh);
     delete this;
     return retval;
@@ -23,12 +23,14 @@
 #define MBED_FATFILEHANDLE_H
 
 #include "FileHandle.h"
+#include "ff.h"
 
 using namespace mbed;
 
 class FATFileHandle : public FileHandle {
 public:
 
+    FATFileHandle();
     FATFileHandle(FIL fh);
     virtual int close();
     virtual ssize_t write(const void* buffer, size_t length);
@@ -38,10 +40,17 @@ public:
     virtual int fsync();
     virtual off_t flen();
 
+    // Handles come from a fixed pool of FFS_MAX_FILES slots rather than the
+    // heap; new returns NULL once every slot is in use, or if the object
+    // would not fit in a slot.
+    static void *operator new(size_t size) throw();
+    static void operator delete(void *p);
+
 protected:
 
     FIL _fh;
 
+    friend class FATFileSystem;
 };
 
 #endif
@@ -44,6 +44,7 @@ FATFileSystem *FATFileSystem::_ffs[_VOLUMES] = {0};
 
 FATFileSystem::FATFileSystem(const char* n) : FileSystemLike(n) {
     debug_if(FFS_DBG, "FATFileSystem(%s)\n", n);
+    flush_lookup_cache();
     for(int i=0; i<_VOLUMES; i++) {
         if(_ffs[i] == 0) {
             _ffs[i] = this;
@@ -65,10 +66,99 @@ FATFileSystem::~FATFileSystem() {
     }
 }
 
+/* Build "N:/name" into n without overflowing it; returns -1 if it won't fit */
+static int make_path(char *n, int fsid, const char *name) {
+    if (fsid < 0 || fsid > 9) {
+        return -1;
+    }
+    n[0] = '0' + fsid;
+    n[1] = ':';
+    n[2] = '/';
+    int i = 3;
+    while (*name) {
+        if (i >= FFS_MAX_PATH - 1) {
+            return -1;
+        }
+        n[i++] = *name++;
+    }
+    n[i] = 0;
+    return 0;
+}
+
+void FATFileSystem::flush_lookup_cache() {
+#if FFS_LOOKUP_CACHE
+    ffs_lock();
+    for (int i = 0; i < FFS_LOOKUP_CACHE; i++) {
+        _lookup[i].name[0] = 0;
+    }
+    _lookup_next = 0;
+    ffs_unlock();
+#endif
+}
+
+int FATFileSystem::_lookup_find(const char *name, FIL *fp) {
+#if FFS_LOOKUP_CACHE
+    ffs_lock();
+    if (_fs.fs_type == 0) {
+        ffs_unlock();
+        return 0;                           // Volume dropped since the lookup
+    }
+    WORD id = _fs.id;                       // Read once; a remount bumps it
+    for (int i = 0; i < FFS_LOOKUP_CACHE; i++) {
+        LookupEntry *e = &_lookup[i];
+        if (e->name[0] == 0 || e->id != id || strcmp(e->name, name) != 0) {
+            continue;
+        }
+        fp->fs = &_fs;
+        fp->id = e->id;                     // f_read's validate() rejects it if the volume moves on
+        fp->flag = FA_READ;
+        fp->fptr = 0;
+        fp->fsize = e->fsize;
+        fp->sclust = e->sclust;
+        fp->dsect = 0;
+#if !_FS_READONLY
+        fp->dir_sect = e->dir_sect;
+        fp->dir_ptr = _fs.win + e->dir_ofs;
+#endif
+#if _USE_FASTSEEK
+        fp->cltbl = 0;
+#endif
+        ffs_unlock();
+        return 1;
+    }
+    ffs_unlock();
+#endif
+    return 0;
+}
+
+void FATFileSystem::_lookup_store(const char *name, const FIL *fp) {
+#if FFS_LOOKUP_CACHE
+    ffs_lock();
+    if (fp->id != _fs.id) {
+        ffs_unlock();
+        return;                             // Remounted since f_open
+    }
+    LookupEntry *e = &_lookup[_lookup_next];
+    _lookup_next = (_lookup_next + 1) % FFS_LOOKUP_CACHE;
+    strcpy(e->name, name);                  // Caller checked the length
+    e->id = fp->id;
+    e->sclust = fp->sclust;
+    e->fsize = fp->fsize;
+#if !_FS_READONLY
+    e->dir_sect = fp->dir_sect;
+    e->dir_ofs = (WORD)(fp->dir_ptr - _fs.win);
+#endif
+    ffs_unlock();
+#endif
+}
+
 FileHandle *FATFileSystem::open(const char* name, int flags) {
     debug_if(FFS_DBG, "open(%s) on filesystem [%s], drv [%d]\n", name, _name, _fsid);
-    char n[64];
-    sprintf(n, "%d:/%s", _fsid, name);
+    char n[FFS_MAX_PATH];
+    if (make_path(n, _fsid, name)) {
+        debug_if(FFS_DBG, "open(%s): path longer than %d\n", name, FFS_MAX_PATH - 1);
+        return NULL;
+    }
     
     /* POSIX flags -> FatFS open mode */
     BYTE openmode;
@@ -87,19 +177,37 @@ FileHandle *FATFileSystem::open(const char* name, int flags) {
         }
     }
     
-    FIL fh;
-    FRESULT res = f_open(&fh, n, openmode);
+    FATFileHandle *fh = new FATFileHandle();
+    if (fh == NULL) {
+        debug_if(FFS_DBG, "open(%s): no free file handle\n", name);
+        return NULL;
+    }
+    
+    if (openmode == FA_READ && _lookup_find(name, &fh->_fh)) {
+        debug_if(FFS_DBG, "open(%s): lookup cache hit\n", name);
+        return fh;
+    }
+    if (openmode != FA_READ) {
+        flush_lookup_cache();
+    }
+    
+    FRESULT res = f_open(&fh->_fh, n, openmode);
     if (res) { 
         debug_if(FFS_DBG, "f_open('w') failed: %d\n", res);
+        delete fh;
         return NULL;
     }
+    if (openmode == FA_READ) {
+        _lookup_store(name, &fh->_fh);
+    }
     if (flags & O_APPEND) {
-        f_lseek(&fh, fh.fsize);
+        f_lseek(&fh->_fh, fh->_fh.fsize);
     }
-    return new FATFileHandle(fh);
+    return fh;
 }
     
 int FATFileSystem::remove(const char *filename) {
+    flush_lookup_cache();
     FRESULT res = f_unlink(filename);
     if (res) { 
         debug_if(FFS_DBG, "f_unlink() failed: %d\n", res);
@@ -109,6 +217,7 @@ int FATFileSystem::remove(const char *filename) {
 }
 
 int FATFileSystem::format() {
+    flush_lookup_cache();
     FRESULT res = f_mkfs(_fsid, 0, 512); // Logical drive number, Partitioning rule, Allocation unit size (bytes per cluster)
     if (res) {
         debug_if(FFS_DBG, "f_mkfs() failed: %d\n", res);
@@ -127,6 +236,7 @@ DirHandle *FATFileSystem::opendir(const char *name) {
 }
 
 int FATFileSystem::mkdir(const char *name, mode_t mode) {
+    flush_lookup_cache();
     FRESULT res = f_mkdir(name);
     return res == 0 ? 0 : -1;
 }
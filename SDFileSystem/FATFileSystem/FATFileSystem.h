@@ -52,6 +52,28 @@ public:
     virtual int disk_sync() { return 0; }
     virtual uint64_t disk_sectors() = 0;
 
+    void flush_lookup_cache();
+
+protected:
+
+    // Result of a successful read-only f_open, enough to rebuild the FIL
+    // without walking the directory again.
+    struct LookupEntry {
+        char name[FFS_MAX_PATH];
+        WORD id;                // FATFS mount ID the entry was taken under
+        DWORD sclust;
+        DWORD fsize;
+        DWORD dir_sect;
+        WORD dir_ofs;           // Offset of the directory entry inside _fs.win
+    };
+
+    int _lookup_find(const char *name, FIL *fp);
+    void _lookup_store(const char *name, const FIL *fp);
+
+#if FFS_LOOKUP_CACHE
+    LookupEntry _lookup[FFS_LOOKUP_CACHE];
+    int _lookup_next;
+#endif
 };
 
 #endif
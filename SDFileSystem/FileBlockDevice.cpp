@@ -0,0 +1,147 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2012 ARM Limited
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/* Host-only block device: the board has no files to back it, so the whole
+ * translation unit drops out of target builds.
+ */
+#if defined(__linux__)
+
+#include "FileBlockDevice.h"
+#include "mbed_debug.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FBD_DBG             0
+
+// Bytes clocked per single-block SPI transfer in SDFileSystem: 6-byte
+// command, a few R1/token polls, 512 data bytes, 2 CRC bytes and the trailer.
+#define SD_BLOCK_BYTES      (6 + 8 + 512 + 2 + 2)
+// Card-side programming time after a CMD24 before busy is released.
+#define SD_WRITE_BUSY_US    500
+
+FileBlockDevice::FileBlockDevice(const char* path, const char* name) :
+    FATFileSystem(name), _sectors(0), _read_latency_us(0), _write_latency_us(0),
+    _bytes_per_sec(0), _sleep(0), _sim_us(0), _reads(0), _writes(0) {
+    _fd = ::open(path, O_RDWR);
+    if (_fd < 0) {
+        debug("Couldn't open disk image %s\n", path);
+    }
+}
+
+FileBlockDevice::~FileBlockDevice() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+int FileBlockDevice::create_image(const char* path, uint64_t sectors) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    int res = ftruncate(fd, (off_t)(sectors * 512));
+    ::close(fd);
+    return res == 0 ? 0 : -1;
+}
+
+int FileBlockDevice::disk_initialize() {
+    if (_fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+        return 1;
+    }
+    _sectors = st.st_size / 512;
+    debug_if(FBD_DBG, "FileBlockDevice: %lld sectors\n", _sectors);
+    return 0;
+}
+
+int FileBlockDevice::disk_status() { return _fd < 0 ? 1 : 0; }
+
+int FileBlockDevice::disk_read(uint8_t *buffer, uint64_t block_number) {
+    if (block_number >= _sectors) {
+        return 1;
+    }
+    if (pread(_fd, buffer, 512, (off_t)(block_number * 512)) != 512) {
+        return 1;
+    }
+    _reads++;
+    _charge(_read_latency_us);
+    return 0;
+}
+
+int FileBlockDevice::disk_write(const uint8_t *buffer, uint64_t block_number) {
+    if (block_number >= _sectors) {
+        return 1;
+    }
+    if (pwrite(_fd, buffer, 512, (off_t)(block_number * 512)) != 512) {
+        return 1;
+    }
+    _writes++;
+    _charge(_write_latency_us);
+    return 0;
+}
+
+int FileBlockDevice::disk_sync() {
+    return fsync(_fd) == 0 ? 0 : 1;
+}
+
+uint64_t FileBlockDevice::disk_sectors() { return _sectors; }
+
+void FileBlockDevice::set_timing(uint32_t read_latency_us, uint32_t write_latency_us, uint32_t bytes_per_sec) {
+    _read_latency_us = read_latency_us;
+    _write_latency_us = write_latency_us;
+    _bytes_per_sec = bytes_per_sec;
+}
+
+void FileBlockDevice::set_sd_timing(uint32_t spi_hz) {
+    uint32_t bytes_per_sec = spi_hz / 8;
+    // Latency covers the framing bytes; the 512 data bytes are charged by
+    // _charge at the raw SPI rate.
+    uint32_t framing_us = (uint32_t)((uint64_t)(SD_BLOCK_BYTES - 512) * 1000000 / bytes_per_sec);
+    set_timing(framing_us, framing_us + SD_WRITE_BUSY_US, bytes_per_sec);
+}
+
+void FileBlockDevice::set_sleep(int sleep) {
+    _sleep = sleep;
+}
+
+void FileBlockDevice::reset_stats() {
+    _sim_us = 0;
+    _reads = 0;
+    _writes = 0;
+}
+
+void FileBlockDevice::_charge(uint32_t latency_us) {
+    uint64_t us = latency_us;
+    if (_bytes_per_sec) {
+        us += (uint64_t)512 * 1000000 / _bytes_per_sec;
+    }
+    _sim_us += us;
+    if (_sleep && us) {
+        usleep((useconds_t)us);
+    }
+}
+
+#endif // __linux__
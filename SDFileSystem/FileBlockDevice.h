@@ -0,0 +1,105 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2012 ARM Limited
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef MBED_FILEBLOCKDEVICE_H
+#define MBED_FILEBLOCKDEVICE_H
+
+#include "FATFileSystem.h"
+#include <stdint.h>
+
+/** Access a FAT file system stored in a disk image file on the host
+ *
+ * Only built on Linux hosts. Sector reads and writes go to the image with
+ * pread/pwrite, optionally charged with the latency and throughput of the
+ * SPI SD card path so timings from the host track those on the board.
+ *
+ * @code
+ * #include "FileBlockDevice.h"
+ *
+ * FileBlockDevice::create_image("fat16.img", 32 * 2048); // 32MB -> FAT16
+ * FileBlockDevice img("fat16.img", "sd");
+ * img.format();
+ * img.set_sd_timing(1000000);                         // 1MHz SPI, as SDFileSystem
+ *
+ * FILE *fp = fopen("/sd/myfile.txt", "w");
+ * fprintf(fp, "Hello World!\n");
+ * fclose(fp);
+ * @endcode
+ */
+class FileBlockDevice : public FATFileSystem {
+public:
+
+    /** Create the File System backed by a disk image
+     *
+     * @param path Disk image file; must already exist (see create_image)
+     * @param name The name used to access the virtual filesystem
+     */
+    FileBlockDevice(const char* path, const char* name);
+    virtual ~FileBlockDevice();
+
+    virtual int disk_initialize();
+    virtual int disk_status();
+    virtual int disk_read(uint8_t * buffer, uint64_t block_number);
+    virtual int disk_write(const uint8_t * buffer, uint64_t block_number);
+    virtual int disk_sync();
+    virtual uint64_t disk_sectors();
+
+    /** Create (or truncate) a zero-filled image of the given number of
+     *  512-byte sectors. f_mkfs picks FAT12/16/32 from the resulting size.
+     *
+     * @returns 0 on success, -1 on error
+     */
+    static int create_image(const char* path, uint64_t sectors);
+
+    /** Charge every sector access with fixed command latency plus transfer
+     *  time at bytes_per_sec. All zeros disables injection.
+     */
+    void set_timing(uint32_t read_latency_us, uint32_t write_latency_us, uint32_t bytes_per_sec);
+
+    /** Approximate SDFileSystem's single-block SPI transfers at spi_hz */
+    void set_sd_timing(uint32_t spi_hz);
+
+    /** If nonzero, injected time is slept for; otherwise it is only added to
+     *  simulated_us() so runs stay fast but still report card-like numbers.
+     */
+    void set_sleep(int sleep);
+
+    uint64_t simulated_us() { return _sim_us; }
+    uint32_t sectors_read() { return _reads; }
+    uint32_t sectors_written() { return _writes; }
+    void reset_stats();
+
+protected:
+
+    void _charge(uint32_t latency_us);
+
+    int _fd;
+    uint64_t _sectors;
+    uint32_t _read_latency_us;
+    uint32_t _write_latency_us;
+    uint32_t _bytes_per_sec;
+    int _sleep;
+    uint64_t _sim_us;
+    uint32_t _reads;
+    uint32_t _writes;
+};
+
+#endif
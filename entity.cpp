@@ -0,0 +1,209 @@
+#include "entity.h"
+
+#include "globals.h"
+#include "flow.h"
+
+// Ticks between ghost steps
+#define GHOST_PERIOD    5
+
+// Ghosts chase a player within this many steps...
+#define GHOST_SIGHT     6
+
+// ...but never stray further than this from where they started
+#define GHOST_LEASH     4
+
+/**
+ * Storage for all entities.
+ */
+static EntityList ents;
+
+/**
+ * Spatial index: a coarse grid of ENT_CELL x ENT_CELL tile cells, each holding
+ * a singly linked list of the entities inside it (threaded through next[]).
+ * Entities of both maps share the grid; lookups filter on map.
+ */
+static signed char head[ENT_GRID * ENT_GRID];
+static signed char next[MAX_ENTITIES];
+static int index_ready;
+
+static int cell_of(int x, int y)
+{
+    int cx = x / ENT_CELL, cy = y / ENT_CELL;
+    if (cx < 0) cx = 0;
+    if (cy < 0) cy = 0;
+    if (cx >= ENT_GRID) cx = ENT_GRID - 1;
+    if (cy >= ENT_GRID) cy = ENT_GRID - 1;
+    return cy * ENT_GRID + cx;
+}
+
+static void index_add(int e)
+{
+    int c = cell_of(ents.x[e], ents.y[e]);
+    next[e] = head[c];
+    head[c] = e;
+}
+
+static void index_remove(int e)
+{
+    signed char* p = &head[cell_of(ents.x[e], ents.y[e])];
+    while (*p != -1 && *p != e) p = &next[*p];
+    if (*p == e) *p = next[e];
+}
+
+EntityList* get_entities()
+{
+    return &ents;
+}
+
+int entity_add(int type, int x, int y, DrawFunc draw)
+{
+    if (!index_ready) {
+        for (int c = 0; c < ENT_GRID * ENT_GRID; c++) head[c] = -1;
+        index_ready = 1;
+    }
+    int e = 0;
+    while (e < ents.count && ents.map[e]) e++;                                  // reuse a hole if there is one
+    if (e == MAX_ENTITIES) return -1;
+    if (e == ents.count) ents.count++;
+
+    ents.map[e] = get_active_map();
+    ents.x[e] = ents.px[e] = x;
+    ents.y[e] = ents.py[e] = y;
+    ents.hx[e] = x;
+    ents.hy[e] = y;
+    ents.type[e] = type;
+    ents.state[e] = 0;
+    ents.timer[e] = e % GHOST_PERIOD;                                           // stagger so they don't all step together
+    ents.draw[e] = draw;
+    index_add(e);
+    return e;
+}
+
+void entity_remove(int e)
+{
+    index_remove(e);
+    ents.map[e] = NULL;
+    while (ents.count && !ents.map[ents.count-1]) ents.count--;
+}
+
+void entity_move(int e, int x, int y)
+{
+    if (cell_of(x, y) != cell_of(ents.x[e], ents.y[e])) {
+        index_remove(e);
+        ents.x[e] = x;
+        ents.y[e] = y;
+        index_add(e);
+    } else {
+        ents.x[e] = x;
+        ents.y[e] = y;
+    }
+}
+
+int entity_at(int x, int y, int type)
+{
+    if (!index_ready) return -1;
+    Map* m = get_active_map();
+    for (int e = head[cell_of(x, y)]; e != -1; e = next[e]) {
+        if (ents.x[e] == x && ents.y[e] == y && ents.map[e] == m &&
+            (type == -1 || ents.type[e] == type)) return e;
+    }
+    return -1;
+}
+
+DrawFunc entity_draw_at(int x, int y)
+{
+    int e = entity_at(x, y, -1);
+    return e == -1 ? NULL : ents.draw[e];
+}
+
+/**
+ * Returns 1 if entity e may step onto (x,y).
+ */
+static int can_enter(int x, int y, int e)
+{
+    int lx = x - ents.hx[e], ly = y - ents.hy[e];
+    if ((lx < 0 ? -lx : lx) + (ly < 0 ? -ly : ly) > GHOST_LEASH) return 0;
+    return map_walkable(x, y) && entity_at(x, y, -1) == -1;
+}
+
+/**
+ * Ghosts close in on a player in sight by walking down the distance field
+ * toward them. Otherwise they drift up and down their column, turning around
+ * at anything in the way.
+ */
+static void ghost_think(int e)
+{
+    int ex = ents.x[e], ey = ents.y[e];
+    int d = flow_dist(ex, ey);
+    if (!d) return;                                                             // got them; stay put
+    if (d <= GHOST_SIGHT) {
+        int dx, dy;
+        if (flow_step(ex, ey, &dx, &dy, can_enter, e)) {
+            entity_move(e, ex + dx, ey + dy);
+            return;
+        }
+    }
+    int dy = ents.state[e] ? 1 : -1;
+    int x = ents.x[e], y = ents.y[e] + dy;
+    if (!can_enter(x, y, e)) {
+        ents.state[e] = !ents.state[e];
+        return;
+    }
+    entity_move(e, x, y);
+}
+
+int entity_update(int x, int y)
+{
+    Map* m = get_active_map();
+    int moved = 0;
+    flow_update(x, y);                                                          // one field shared by every chaser
+    for (int e = 0; e < ents.count; e++) {
+        if (ents.map[e] != m) continue;
+        ents.px[e] = ents.x[e];
+        ents.py[e] = ents.y[e];
+        if (ents.timer[e]) {
+            ents.timer[e]--;
+            continue;
+        }
+        switch (ents.type[e]) {
+            case GHOST:
+                ghost_think(e);
+                ents.timer[e] = GHOST_PERIOD - 1;
+                break;
+            default:
+                break;
+        }
+        if (ents.x[e] != ents.px[e] || ents.y[e] != ents.py[e]) moved++;
+    }
+    return moved;
+}
+
+int entity_check()
+{
+    if (!index_ready) return ents.count ? -1 : 0;
+    int seen[MAX_ENTITIES] = {0};
+    int listed = 0;
+    for (int c = 0; c < ENT_GRID * ENT_GRID; c++) {
+        for (int e = head[c]; e != -1; e = next[e]) {
+            const char* err = NULL;
+            if (e < 0 || e >= ents.count || !ents.map[e]) err = "dead entity indexed";
+            else if (seen[e]++) err = "indexed twice";
+            else if (cell_of(ents.x[e], ents.y[e]) != c) err = "wrong cell";
+            else if (++listed > ents.count) err = "index loop";
+            if (err) {
+                pc.printf("entity_check: cell %d entity %d: %s\r\n", c, e, err);
+                return -1;
+            }
+        }
+    }
+    for (int e = 0; e < ents.count; e++) {
+        if (!ents.map[e]) continue;
+        int off = ents.map[e] == get_active_map() &&                            // map_width is only known for the active map
+                  (ents.x[e] < 0 || ents.y[e] < 0 || ents.x[e] >= map_width() || ents.y[e] >= map_height());
+        if (!seen[e] || off) {
+            pc.printf("entity_check: entity %d: %s\r\n", e, off ? "off its map" : "not indexed");
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include "map.h"
+
+// Maximum number of entities across all maps. Every actor on every map
+// counts, evicted maps included: the built-in maps start with 32 (20 ghosts,
+// 5 slimes, 5 rocks and 2 NPCs). Adds past the cap fail. Override with
+// -DMAX_ENTITIES=n; the spatial index stores indices in a signed char.
+#ifndef MAX_ENTITIES
+#define MAX_ENTITIES    48
+#endif
+#if MAX_ENTITIES > 127
+#error MAX_ENTITIES must fit in a signed char
+#endif
+
+// MapItem types that live in the entity list rather than the map tables:
+// the actors that move by themselves or get pushed about
+#define ENTITY_TYPES    ((1 << NPC) | (1 << SLIME) | (1 << GHOST) | (1 << ROCK))
+
+// Side length, in tiles, of one cell of the entity spatial index
+#define ENT_CELL        8
+
+// Cells per side of the spatial index; covers maps up to 56x56 tiles
+#define ENT_GRID        7
+
+/**
+ * Actors that move (ghosts each tick, rocks, slimes and NPCs when pushed)
+ * live here instead of in the map HashTable, so moving one is a few array
+ * writes rather than a removeItem/free/malloc/insertItem cycle.
+ *
+ * The list is a structure of arrays: entity e is x[e], y[e], type[e], etc.
+ * Entity indices are stable until the entity is removed.
+ */
+typedef struct {
+    /**
+     * One past the highest index in use. Removed entities leave a hole with
+     * map[e] == NULL until the slot is reused.
+     */
+    int count;
+
+    Map* map[MAX_ENTITIES];             // Map the entity is on, NULL if unused
+    short x[MAX_ENTITIES], y[MAX_ENTITIES];     // Current location
+    short px[MAX_ENTITIES], py[MAX_ENTITIES];   // Location before the last update
+    short hx[MAX_ENTITIES], hy[MAX_ENTITIES];   // Where the entity was added
+    unsigned char type[MAX_ENTITIES];   // MapItem type: GHOST, SLIME, ...
+    unsigned char state[MAX_ENTITIES];  // Per-type state, e.g. patrol direction
+    unsigned char timer[MAX_ENTITIES];  // Ticks until the entity next acts
+    DrawFunc draw[MAX_ENTITIES];        // Drawing function, as for MapItems
+} EntityList;
+
+/**
+ * Returns the entity list.
+ */
+EntityList* get_entities();
+
+/**
+ * Add an entity of the given type at (x,y) on the active map. Returns its
+ * index, or -1 if the list is full.
+ */
+int entity_add(int type, int x, int y, DrawFunc draw);
+
+/**
+ * Remove entity e.
+ */
+void entity_remove(int e);
+
+/**
+ * Move entity e to (x,y) on its map, keeping the spatial index up to date.
+ */
+void entity_move(int e, int x, int y);
+
+/**
+ * Returns the index of an entity at (x,y) on the active map, or -1 if there is
+ * none. If type is not -1, only entities of that type are considered.
+ */
+int entity_at(int x, int y, int type);
+
+/**
+ * Returns the drawing function of the entity at (x,y) on the active map, or
+ * NULL if there is none.
+ */
+DrawFunc entity_draw_at(int x, int y);
+
+/**
+ * Run one tick of behaviour for every entity on the active map, with the
+ * player at (x,y). Afterwards px/py hold where each entity was before the
+ * tick, so draw_game can repaint the tiles that changed. Returns the number of
+ * entities that moved.
+ */
+int entity_update(int x, int y);
+
+/**
+ * Check that every entity is on its map and listed exactly once in the
+ * spatial index, in the right cell. Prints the first problem found to the
+ * serial console and returns -1, or returns 0.
+ */
+int entity_check();
+
+#endif // ENTITY_H
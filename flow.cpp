@@ -0,0 +1,82 @@
+#include "flow.h"
+
+#include "map.h"
+
+#include <string.h>
+
+#define SIDE    (2*FLOW_RANGE + 1)
+
+static const int step_x[4] = {0, 0, 1, -1};    // N, S, E, W
+static const int step_y[4] = {-1, 1, 0, 0};
+
+/**
+ * The field: dist[] over the window whose top-left tile is (ox,oy), plus what
+ * it was built for so flow_update can tell when it is stale. queue[] is the
+ * breadth-first frontier; every tile enters it at most once.
+ */
+static unsigned char dist[SIDE * SIDE];
+static unsigned short queue[SIDE * SIDE];
+static int ox, oy;
+static int target_x = -1, target_y = -1;
+static Map* built_map;
+static unsigned built_version;
+
+static void build()
+{
+    memset(dist, FLOW_FAR, sizeof(dist));
+    int w = map_width(), h = map_height();
+    int head = 0, tail = 0;
+    int c = FLOW_RANGE * SIDE + FLOW_RANGE;                                     // the target, at the centre
+    dist[c] = 0;
+    queue[tail++] = c;
+    while (head < tail) {
+        int i = queue[head++];
+        if (dist[i] == FLOW_FAR - 1) continue;                                  // any further and the distance would read as FLOW_FAR
+        int x = i % SIDE, y = i / SIDE;
+        for (int d = 0; d < 4; d++) {
+            int nx = x + step_x[d], ny = y + step_y[d];
+            if (nx < 0 || ny < 0 || nx >= SIDE || ny >= SIDE) continue;
+            int n = ny * SIDE + nx;
+            if (dist[n] != FLOW_FAR) continue;
+            int mx = ox + nx, my = oy + ny;
+            if (mx >= w || my >= h || !map_walkable(mx, my)) continue;          // map_walkable handles mx, my < 0
+            dist[n] = dist[i] + 1;
+            queue[tail++] = n;
+        }
+    }
+}
+
+void flow_update(int x, int y)
+{
+    if (x == target_x && y == target_y && built_map == get_active_map() &&
+        built_version == map_version()) return;
+    target_x = x;
+    target_y = y;
+    ox = x - FLOW_RANGE;
+    oy = y - FLOW_RANGE;
+    built_map = get_active_map();
+    built_version = map_version();
+    build();
+}
+
+int flow_dist(int x, int y)
+{
+    int i = x - ox, j = y - oy;
+    if (i < 0 || j < 0 || i >= SIDE || j >= SIDE) return FLOW_FAR;
+    return dist[j * SIDE + i];
+}
+
+int flow_step(int x, int y, int* dx, int* dy, int (*ok)(int x, int y, int arg), int arg)
+{
+    int here = flow_dist(x, y);
+    int best = here;
+    for (int d = 0; d < 4; d++) {
+        int nx = x + step_x[d], ny = y + step_y[d];
+        int nd = flow_dist(nx, ny);
+        if (nd >= best || (ok && !ok(nx, ny, arg))) continue;
+        best = nd;
+        *dx = step_x[d];
+        *dy = step_y[d];
+    }
+    return best < here;
+}
@@ -0,0 +1,39 @@
+#ifndef FLOW_H
+#define FLOW_H
+
+// The field covers tiles within this many steps of the target in each axis
+#define FLOW_RANGE  12
+
+// Distance reported for tiles that are unreachable or outside the field
+#define FLOW_FAR    255
+
+/**
+ * A distance field (Dijkstra map) toward a single target on the active map:
+ * every walkable tile near the target holds its walking distance to it. Any
+ * number of chasers can then each take one step downhill per tick at O(1)
+ * cost, instead of running a path search apiece.
+ *
+ * The field covers a (2*FLOW_RANGE+1)^2 window centred on the target, so its
+ * memory and rebuild cost are fixed regardless of map size.
+ */
+
+/**
+ * Point the field at (x,y). It is rebuilt only if the target moved, the
+ * active map changed, or the map contents changed since the last build.
+ */
+void flow_update(int x, int y);
+
+/**
+ * Walking distance from (x,y) to the target, or FLOW_FAR. Tiles more than
+ * FLOW_FAR - 1 steps away, as on a winding path, also read FLOW_FAR.
+ */
+int flow_dist(int x, int y);
+
+/**
+ * Find a step from (x,y) toward the target: a neighbouring tile with a lower
+ * distance for which ok(x, y, arg) returns nonzero (ok may be NULL). Returns 1
+ * and stores the step in (dx,dy), or 0 if no such neighbour exists.
+ */
+int flow_step(int x, int y, int* dx, int* dy, int (*ok)(int x, int y, int arg), int arg);
+
+#endif // FLOW_H
@@ -0,0 +1,238 @@
+#include "fs_bench.h"
+
+#include "mbed.h"
+#include "FATFileSystem.h"
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+static char buf[FS_BENCH_MAX_BUF];
+static const int buf_sizes[] = {64, 512, FS_BENCH_MAX_BUF};
+static BenchClock bench_clock;
+static FATFileSystem* bench_fs;
+
+/**
+ * Wall clock in microseconds, used when no clock is given.
+ */
+static uint32_t wall_us()
+{
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#else
+    return us_ticker_read();
+#endif
+}
+
+/**
+ * FAT width of the volume under test: 12, 16 or 32, or 0 before it is
+ * mounted. FatFs mounts on first access, so this is valid from the first
+ * report on.
+ */
+static int fat_bits()
+{
+    switch (bench_fs->_fs.fs_type) {
+        case FS_FAT12: return 12;
+        case FS_FAT16: return 16;
+        case FS_FAT32: return 32;
+    }
+    return 0;
+}
+
+/**
+ * Print one result line. kbps is derived from bytes and the elapsed time.
+ */
+static void report(const char* test, int size, long bytes, int ops, uint32_t us)
+{
+    long kbps = us ? (long)((uint64_t)bytes * 1000000 / 1024 / us) : 0;
+    printf("%s,%d,%ld,%d,%lu,%ld,FAT%d\r\n", test, size, bytes, ops, (unsigned long)us, kbps, fat_bits());
+}
+
+/**
+ * Write file_bytes to the scratch file in size byte chunks.
+ */
+static int seq_write(FATFileSystem* fs, long file_bytes, int size)
+{
+    for (int i = 0; i < size; i++) buf[i] = i;
+    uint32_t start = bench_clock();
+    FileHandle* fh = fs->open("bench.bin", O_WRONLY | O_CREAT | O_TRUNC);
+    if (!fh) return -1;
+    int ops = 0;
+    for (long done = 0; done < file_bytes; done += size, ops++) {
+        int n = file_bytes - done < size ? file_bytes - done : size;
+        if (fh->write(buf, n) != n) {
+            fh->close();
+            return -1;
+        }
+    }
+    fh->close();
+    report("seq_write", size, file_bytes, ops, bench_clock() - start);
+    return 0;
+}
+
+/**
+ * Read the scratch file back in size byte chunks.
+ */
+static int seq_read(FATFileSystem* fs, long file_bytes, int size)
+{
+    uint32_t start = bench_clock();
+    FileHandle* fh = fs->open("bench.bin", O_RDONLY);
+    if (!fh) return -1;
+    long total = 0;
+    int ops = 0;
+    int n;
+    while ((n = fh->read(buf, size)) > 0) {
+        total += n;
+        ops++;
+    }
+    fh->close();
+    if (total != file_bytes) return -1;
+    report("seq_read", size, total, ops, bench_clock() - start);
+    return 0;
+}
+
+/**
+ * Read FS_BENCH_RAND_OPS sector-aligned 512 byte blocks from the scratch
+ * file. The offsets come from a fixed LCG so runs are comparable.
+ */
+static int rand_read(FATFileSystem* fs, long file_bytes)
+{
+    long blocks = file_bytes / 512;
+    if (!blocks) return 0;
+    uint32_t seed = 12345;
+    uint32_t start = bench_clock();
+    FileHandle* fh = fs->open("bench.bin", O_RDONLY);
+    if (!fh) return -1;
+    for (int i = 0; i < FS_BENCH_RAND_OPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        fh->lseek((seed >> 8) % blocks * 512, SEEK_SET);
+        if (fh->read(buf, 512) != 512) {
+            fh->close();
+            return -1;
+        }
+    }
+    fh->close();
+    report("rand_read", 512, (long)FS_BENCH_RAND_OPS * 512, FS_BENCH_RAND_OPS, bench_clock() - start);
+    return 0;
+}
+
+/**
+ * Create FS_BENCH_FILES empty files, list the root directory, then delete
+ * them again, reporting each phase separately.
+ */
+static int create_list_delete(FATFileSystem* fs)
+{
+    char name[16];
+    uint32_t start = bench_clock();
+    for (int i = 0; i < FS_BENCH_FILES; i++) {
+        sprintf(name, "b%02d.tmp", i);
+        FileHandle* fh = fs->open(name, O_WRONLY | O_CREAT | O_TRUNC);
+        if (!fh) return -1;
+        fh->close();
+    }
+    report("create", 0, 0, FS_BENCH_FILES, bench_clock() - start);
+
+    start = bench_clock();
+    DirHandle* dir = fs->opendir("/");
+    if (!dir) return -1;
+    int entries = 0;
+    while (dir->readdir()) entries++;
+    dir->closedir();
+    report("readdir", 0, 0, entries, bench_clock() - start);
+
+    start = bench_clock();
+    for (int i = 0; i < FS_BENCH_FILES; i++) {
+        sprintf(name, "b%02d.tmp", i);
+        if (fs->remove(name)) return -1;
+    }
+    report("delete", 0, 0, FS_BENCH_FILES, bench_clock() - start);
+    return 0;
+}
+
+/**
+ * Create FS_BENCH_FILES empty directories in the root, then remove them
+ * again. Each mkdir allocates and clears a cluster, so this tracks cluster
+ * size and FAT type more closely than creating files does.
+ */
+static int mkdir_rmdir(FATFileSystem* fs)
+{
+    char name[16];
+    uint32_t start = bench_clock();
+    for (int i = 0; i < FS_BENCH_FILES; i++) {
+        sprintf(name, "d%02d", i);
+        if (fs->mkdir(name, 0777)) return -1;
+    }
+    report("mkdir", 0, 0, FS_BENCH_FILES, bench_clock() - start);
+
+    start = bench_clock();
+    for (int i = 0; i < FS_BENCH_FILES; i++) {
+        sprintf(name, "d%02d", i);
+        if (fs->remove(name)) return -1;
+    }
+    report("rmdir", 0, 0, FS_BENCH_FILES, bench_clock() - start);
+    return 0;
+}
+
+int fs_bench(FATFileSystem* fs, long file_bytes, BenchClock clock)
+{
+    bench_clock = clock ? clock : wall_us;
+    bench_fs = fs;
+    int err = 0;
+    printf("test,buf,bytes,ops,us,kbps,fat\r\n");
+    for (unsigned i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++) {
+        if (seq_write(fs, file_bytes, buf_sizes[i])) err = -1;
+        if (seq_read(fs, file_bytes, buf_sizes[i])) err = -1;
+    }
+    if (rand_read(fs, file_bytes)) err = -1;
+    if (create_list_delete(fs)) err = -1;
+    if (mkdir_rmdir(fs)) err = -1;
+    fs->remove("bench.bin");
+    return err;
+}
+
+#if defined(__linux__) && defined(FS_BENCH_MAIN)
+/**
+ * Host entry point: builds a FAT12, a FAT16 and a FAT32 image in turn with
+ * FileBlockDevice and runs the suite twice on each, once raw and once
+ * charged with SDFileSystem's SPI timing so the second set of numbers
+ * approximates the board.
+ *
+ *   g++ -DFS_BENCH_MAIN fs_bench.cpp SDFileSystem/FileBlockDevice.cpp ...
+ *   ./a.out [image] [file_bytes] > results.csv
+ */
+#include "FileBlockDevice.h"
+
+// Image sizes in 512 byte sectors, one per FAT type that f_mkfs picks
+static const uint64_t image_sectors[] = {
+    2 * 2048,                                   // 2MB   -> FAT12
+    32 * 2048,                                  // 32MB  -> FAT16
+    128 * 2048                                  // 128MB -> FAT32
+};
+
+static FileBlockDevice* bench_dev;
+
+static uint32_t sd_us()
+{
+    return wall_us() + (uint32_t)bench_dev->simulated_us();
+}
+
+int main(int argc, char** argv)
+{
+    const char* image = argc > 1 ? argv[1] : "fs_bench.img";
+    long file_bytes = argc > 2 ? atol(argv[2]) : 256 * 1024;
+    int err = 0;
+    for (unsigned i = 0; i < sizeof(image_sectors) / sizeof(image_sectors[0]); i++) {
+        if (FileBlockDevice::create_image(image, image_sectors[i])) return 1;
+        FileBlockDevice dev(image, "sd");
+        bench_dev = &dev;
+        if (dev.format()) return 1;
+        if (fs_bench(&dev, file_bytes, NULL)) err = -1;
+        dev.set_sd_timing(1000000);
+        dev.reset_stats();
+        if (fs_bench(&dev, file_bytes, sd_us)) err = -1;
+    }
+    return err ? 1 : 0;
+}
+#endif
@@ -0,0 +1,39 @@
+#ifndef FS_BENCH_H
+#define FS_BENCH_H
+
+#include <stdint.h>
+
+class FATFileSystem;
+
+/**
+ * Clock used to time benchmark steps, in microseconds. NULL selects the
+ * default wall clock (us_ticker on the board, CLOCK_MONOTONIC on the host).
+ */
+typedef uint32_t (*BenchClock)();
+
+// Largest buffer size exercised by the sequential tests
+#define FS_BENCH_MAX_BUF    4096
+
+// Number of 512 byte reads at random offsets
+#define FS_BENCH_RAND_OPS   64
+
+// Number of files created, listed and deleted, and of directories made
+#define FS_BENCH_FILES      16
+
+/**
+ * Run the file system benchmark suite against a mounted FAT file system and
+ * print one CSV line per measurement to stdout (the pc serial port on the
+ * board), preceded by a header line:
+ *
+ *   test,buf,bytes,ops,us,kbps,fat
+ *
+ * Tests are seq_write and seq_read of file_bytes at each buffer size,
+ * rand_read of 512 byte blocks, create and delete of FS_BENCH_FILES empty
+ * files, readdir of the root directory while they exist, and mkdir and rmdir
+ * of FS_BENCH_FILES empty directories. fat is the
+ * volume's FAT type (FAT12, FAT16 or FAT32). Scratch files are removed
+ * afterwards. Returns 0 on success, -1 if any step failed.
+ */
+int fs_bench(FATFileSystem* fs, long file_bytes, BenchClock clock);
+
+#endif // FS_BENCH_H
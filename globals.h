@@ -4,11 +4,7 @@
 //=============================================
 #ifndef GLOBAL_H
 #define GLOBAL_H
-#define HEIGHT1 50
-#define WIDTH1  50
-#define HEIGHT2 24
-#define WIDTH2  25
-#define NUMBUCKETS 7
+#include "map_size.h"
 
 // all colors I added
 #define BACKGROUND      0x14491f
@@ -1,6 +1,7 @@
 #include "graphics.h"
 
 #include "globals.h"
+#include "sim.h"
 
 // Player Sprite
 void draw_player(int u, int v, int key)
@@ -332,121 +333,139 @@ void draw_heart(int u, int v)
     uLCD.BLIT(u, v, 11, 11, &heart_sprite[0][0]);
 }
 
+/**
+ * The status bars are drawn incrementally. Each text field remembers what is
+ * on screen and only the characters that differ are sent to the LCD; the
+ * health bar remembers its width and only repaints the segment that changed.
+ * Like the map, none of the status bar or omni icon is drawn in a headless
+ * run.
+ */
+#define COORDS_COL  0           // "(x,y)" at the top left
+#define COUNTER_COL 7           // "Slimes: n/5" or "Lives: n/3" at the top right
+#define FIELD_LEN   12
+#define BAR_LEFT    70          // health bar, full at BAR_RIGHT
+#define BAR_RIGHT   120
+#define BAR_TOP     122
+#define BAR_BOTTOM  128
+
+typedef struct {
+    char text[FIELD_LEN];       // what is on screen, "" if nothing
+    int color;
+} TextField;
+
+static TextField coords, counter;
+static int bar_w = -1;          // colored width of the health bar, -1 if not drawn
+static int bar_color;
+
+/**
+ * Show text in field f at (col, 0), sending only the characters that changed
+ * (all of them if the color changed). Shorter text blanks the leftover tail.
+ */
+static void draw_field(TextField* f, int col, const char* text, int color)
+{
+    int all = color != f->color;
+    int started = 0;
+    for (int i = 0; i < FIELD_LEN - 1 && (text[i] || f->text[i]); i++) {
+        char c = text[i] ? text[i] : ' ';
+        char old = f->text[i] ? f->text[i] : ' ';
+        if (!all && c == old) continue;
+        if (!started) {
+            uLCD.textbackground_color(BLACK);
+            uLCD.color(color);
+            started = 1;
+        }
+        uLCD.locate(col + i, 0);
+        uLCD.printf("%c", c);
+    }
+    strncpy(f->text, text, FIELD_LEN - 1);
+    f->text[FIELD_LEN - 1] = 0;
+    f->color = color;
+}
+
 // upper status holds player coordinates
 void draw_upper_status(int x, int y)
 {
-    uLCD.filled_rectangle(0,8,48,0,BLACK);
-    // Add other status info drawing code here
-
-    uLCD.textbackground_color(BLACK);
-    uLCD.color(GREEN);
-
-    //add player coordinates
-    uLCD.locate(0,0);
-    uLCD.printf("(%d,",x);
-    uLCD.color(GREEN);
-    uLCD.locate(4,0);
-    uLCD.printf("%d)",y);
+    if (sim_headless()) return;
+    char buf[FIELD_LEN];
+    snprintf(buf, sizeof(buf), "(%d,", x);
+    int n = strlen(buf);
+    while (n < 4) buf[n++] = ' ';                                               // y always starts in column 4
+    snprintf(buf + n, sizeof(buf) - n, "%d)", y);
+    draw_field(&coords, COORDS_COL, buf, GREEN);
 }
 
 void draw_slimeCount(int SC)
 {
-    uLCD.textbackground_color(BLACK);
-    uLCD.color(GREEN);
-
-    uLCD.locate(7,0);
-    uLCD.printf("Slimes: %d/5", SC);
+    if (sim_headless()) return;
+    char buf[FIELD_LEN];
+    snprintf(buf, sizeof(buf), "Slimes: %d/5", SC);
+    draw_field(&counter, COUNTER_COL, buf, GREEN);
 }
 
 void clear_slimeCount()
 {
+    if (sim_headless()) return;
     uLCD.filled_rectangle(50,0,127,8,BLACK);
+    counter.text[0] = 0;
 }
 
 void draw_lifeCount(int pL)
 {
-    uLCD.textbackground_color(BLACK);
-    uLCD.color(RED);
-
-    uLCD.locate(7,0);
-    uLCD.printf("Lives: %d/3", pL);
+    if (sim_headless()) return;
+    char buf[FIELD_LEN];
+    snprintf(buf, sizeof(buf), "Lives: %d/3", pL);
+    draw_field(&counter, COUNTER_COL, buf, RED);
 }
 
 void clear_lifeCount()
 {
+    if (sim_headless()) return;
     uLCD.filled_rectangle(50,0,127,8,BLACK);
+    counter.text[0] = 0;
+}
+
+/**
+ * Last pixel column of a health bar whose colored part is w wide. The bar
+ * from BAR_LEFT to BAR_RIGHT is colored up to here and red after it.
+ */
+static int bar_end(int w)
+{
+    return w == BAR_RIGHT - BAR_LEFT ? BAR_RIGHT : BAR_LEFT + w - 1;
 }
 
 // lower status holds player health bar and omni_mode icon if enabled
 void draw_lower_status(int pH, int pHH)
 {
-    uLCD.locate(2,15);
-    uLCD.color(TEXTGREEN);
-    uLCD.text_width(1);
-    uLCD.text_height(1);
-    uLCD.printf("HEALTH:");
-
-    // Draw top border of status bar
-    uLCD.line(0, 118, 127, 118, GREEN);
-
-    // change health bar if taken damage
-    if(pHH == 0) {
-        if(pH == 100) {
-            uLCD.filled_rectangle(70,122,120,128,GREEN);
-        } else if(pH == 80) {
-            uLCD.filled_rectangle(70,122,110,128,GREEN);
-            uLCD.filled_rectangle(110,122,120,128,RED);
-        } else if(pH == 60) {
-            uLCD.filled_rectangle(70,122,100,128,GREEN);
-            uLCD.filled_rectangle(100,122,120,128,RED);
-        } else if(pH == 40) {
-            uLCD.filled_rectangle(70,122,90,128,GREEN);
-            uLCD.filled_rectangle(90,122,120,128,RED);
-        } else if(pH == 20) {
-            uLCD.filled_rectangle(70,122,80,128,GREEN);
-            uLCD.filled_rectangle(80,122,120,128,RED);
-        } else if(pH == 0) {
-            uLCD.filled_rectangle(70,122,120,128,RED);
-        }
-    } else {
-        if(pH == 100) {
-            uLCD.filled_rectangle(70,122,120,128,BLUE);
-        } else if(pH == 90) {
-            uLCD.filled_rectangle(70,122,115,128,BLUE);
-            uLCD.filled_rectangle(115,122,120,128,RED);
-        } else if(pH == 80) {
-            uLCD.filled_rectangle(70,122,110,128,BLUE);
-            uLCD.filled_rectangle(110,122,120,128,RED);
-        } else if(pH == 70) {
-            uLCD.filled_rectangle(70,122,105,128,BLUE);
-            uLCD.filled_rectangle(105,122,120,128,RED);
-        } else if(pH == 60) {
-            uLCD.filled_rectangle(70,122,100,128,BLUE);
-            uLCD.filled_rectangle(100,122,120,128,RED);
-        } else if(pH == 50) {
-            uLCD.filled_rectangle(70,122,95,128,BLUE);
-            uLCD.filled_rectangle(95,122,120,128,RED);
-        } else if(pH == 40) {
-            uLCD.filled_rectangle(70,122,90,128,BLUE);
-            uLCD.filled_rectangle(90,122,120,128,RED);
-        } else if(pH == 30) {
-            uLCD.filled_rectangle(70,122,85,128,BLUE);
-            uLCD.filled_rectangle(85,122,120,128,RED);
-        } else if(pH == 20) {
-            uLCD.filled_rectangle(70,122,80,128,BLUE);
-            uLCD.filled_rectangle(80,122,120,128,RED);
-        } else if(pH == 10) {
-            uLCD.filled_rectangle(70,122,75,128,BLUE);
-            uLCD.filled_rectangle(75,122,120,128,RED);
-        } else if(pH == 0) {
-            uLCD.filled_rectangle(70,122,120,128,RED);
-        }
+    if (sim_headless()) return;
+    if (pH < 0) pH = 0;
+    if (pH > 100) pH = 100;
+    int w = pH * (BAR_RIGHT - BAR_LEFT) / 100;                                  // colored part; the rest is red
+    int color = pHH ? BLUE : GREEN;                                             // blue once the heart powerup is held
+
+    if (bar_w < 0) {                                                            // first time: label and border too
+        uLCD.locate(2,15);
+        uLCD.color(TEXTGREEN);
+        uLCD.text_width(1);
+        uLCD.text_height(1);
+        uLCD.printf("HEALTH:");
+        uLCD.line(0, 118, 127, 118, GREEN);
+    }
+    if (bar_w < 0 || color != bar_color) {                                      // repaint the whole bar
+        if (w > 0) uLCD.filled_rectangle(BAR_LEFT, BAR_TOP, bar_end(w), BAR_BOTTOM, color);
+        if (w < BAR_RIGHT - BAR_LEFT) uLCD.filled_rectangle(BAR_LEFT + w, BAR_TOP, BAR_RIGHT, BAR_BOTTOM, RED);
+    } else if (w > bar_w) {                                                     // grew: extend the colored part
+        uLCD.filled_rectangle(BAR_LEFT + bar_w, BAR_TOP, bar_end(w), BAR_BOTTOM, color);
+    } else if (w < bar_w) {                                                     // shrank: extend the red part
+        uLCD.filled_rectangle(BAR_LEFT + w, BAR_TOP, bar_end(bar_w), BAR_BOTTOM, RED);
     }
+    bar_w = w;
+    bar_color = color;
 }
 
 // border surrounding map
 void draw_border()
 {
+    if (sim_headless()) return;
     uLCD.filled_rectangle(0,     9, 127,  14, BLACK); // Top
     uLCD.filled_rectangle(0,    13,   2, 114, BLACK); // Left
     uLCD.filled_rectangle(0,   114, 127, 117, BLACK); // Bottom
@@ -456,6 +475,7 @@ void draw_border()
 // prints ghost in bottom left corner if omni_mode is active
 void print_omni()
 {
+    if (sim_headless()) return;
     static int omni_sprite[1][121] = {
         {
             BLACK, BLACK, BLACK, BLACK, 0xffffffff, 0xffffffff, 0xffffffff, BLACK, BLACK, BLACK, BLACK,
@@ -478,5 +498,6 @@ void print_omni()
 // clears ghost sprite if omni_mode is disabled
 void clear_omni()
 {
+    if (sim_headless()) return;
     uLCD.filled_rectangle(0,119,11,128, BLACK);
 }
\ No newline at end of file
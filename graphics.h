@@ -49,12 +49,14 @@ void clear_lifeCount();
 void print_omni();
 void clear_omni();
 /**
- * Draw the upper status bar.
+ * Draw the upper status bar. Only the characters that differ from the text
+ * already on screen are sent, so calling this every frame is cheap.
  */
 void draw_upper_status(int x, int y);
 
 /**
- * Draw the lower status bar.
+ * Draw the lower status bar. The health bar repaints only the segment that
+ * grew or shrank since the last call, and in full when its color changes.
  */ 
 void draw_lower_status(int pH, int pHH);
 
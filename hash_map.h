@@ -0,0 +1,436 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+#include "hash_table.h"     // HashTableStats
+
+#include <stdlib.h>
+
+/**
+ * The default Hasher and Equal for HashMap: the key itself, and ==.
+ */
+template <typename Key>
+struct HashMapHash {
+    unsigned operator()(const Key& key) const { return (unsigned) key; }
+};
+
+template <typename Key>
+struct HashMapEqual {
+    bool operator()(const Key& a, const Key& b) const { return a == b; }
+};
+
+// Buckets moved from the old bucket array to the new one by each operation
+// while a HashMap is growing
+#define HASH_MAP_MIGRATE    2
+
+/**
+ * A chained hash table with the key, value, hash and equality as template
+ * parameters, so lookups make no indirect calls and values need no casts.
+ * Hasher and Equal are function objects; a key goes in bucket
+ * hasher(key) % buckets. Values are stored in the entries themselves, so a
+ * small value (like a MapItem) costs one allocation and no extra pointer hop;
+ * for a large one, store a pointer instead.
+ *
+ * Keys and values are copied with =, and entries are allocated with malloc,
+ * so both must be plain data. A pointer returned by find stays valid until the
+ * key is removed or the table destroyed. Statistics are kept as for HashTable.
+ *
+ * With max_load set, the table grows to 2n+1 buckets once it holds more than
+ * max_load entries per bucket. Rather than rehash every entry at once, it
+ * keeps the old bucket array alongside the new one and every later operation
+ * moves HASH_MAP_MIGRATE old buckets across, so the cost of a rehash is
+ * spread over many operations instead of landing on the one that triggered
+ * it. Until an old bucket has been moved its keys are looked up there, and
+ * after that in the new array. reserve grows the same way, straight to the
+ * bucket count it needs; if a grow is already under way, the next one starts
+ * as soon as it finishes.
+ *
+ * Bulk loads (insert_run and insert_array) skip the duplicate check, reserve
+ * room for the new entries up front and allocate them in one block. Entries
+ * from a block that are later removed are kept for reuse by insert, and the
+ * blocks are freed by clear.
+ *
+ * hash_table.cpp implements the HashTable C interface on top of this.
+ */
+template <typename Key, typename Value,
+          typename Hasher = HashMapHash<Key>, typename Equal = HashMapEqual<Key> >
+class HashMap {
+public:
+    explicit HashMap(unsigned num_buckets, unsigned max_load = 0,
+                     const Hasher& hasher = Hasher(), const Equal& equal = Equal())
+        : hasher(hasher), equal(equal), num_buckets(num_buckets), num_entries(0),
+          old_buckets(NULL), old_num_buckets(0), migrated(0), next_num_buckets(0),
+          max_load(max_load), blocks(NULL), spare(NULL)
+    {
+        buckets = (Node**) calloc(num_buckets, sizeof(Node*));
+        reset_stats();
+    }
+
+    ~HashMap()
+    {
+        clear();
+        free(buckets);
+    }
+
+    /**
+     * Returns false if the bucket array could not be allocated.
+     */
+    bool ok() const { return buckets != NULL; }
+
+    /**
+     * Returns the value stored for key, or NULL if the key is not present.
+     */
+    Value* find(const Key& key)
+    {
+        migrate();
+        Node** head;
+        Node* node = *link(key, &head);
+        return node ? &node->value : NULL;
+    }
+
+    /**
+     * As find, but read-only: it neither counts a lookup nor moves buckets of
+     * a grow under way, so scanning the table with it leaves the statistics
+     * and the table's layout alone.
+     */
+    const Value* peek(const Key& key) const
+    {
+        unsigned h = hasher(key);
+        const Node* node = old_buckets && h % old_num_buckets >= migrated ?
+                           old_buckets[h % old_num_buckets] : buckets[h % num_buckets];
+        for (; node; node = node->next) {
+            if (equal(node->key, key)) return &node->value;
+        }
+        return NULL;
+    }
+
+    /**
+     * Store value for key. Returns 1 if the key was already present, after
+     * copying its old value to *old (if old is not NULL); 0 if the key was
+     * added; or -1 if memory ran out.
+     */
+    int insert(const Key& key, const Value& value, Value* old = NULL)
+    {
+        migrate();
+        unsigned long probes0 = probes;
+        Node** head;
+        Node** at = link(key, &head);
+        if (*at) {
+            if (old) *old = (*at)->value;
+            (*at)->value = value;
+            return 1;
+        }
+        Node* node = spare;                                     // reuse an entry from a block if there is one
+        if (node) spare = node->next;
+        else node = (Node*) malloc(sizeof(Node));
+        if (!node) return -1;
+        unsigned chain = probes - probes0 + 1;                  // the search walked the whole chain
+        if (chain > peak_chain) peak_chain = chain;
+        node->key = key;
+        node->value = value;
+        node->next = *head;                                     // new entries go at the head
+        *head = node;
+        num_entries++;
+        if (max_load && !old_buckets && num_entries > max_load * num_buckets) grow();
+        return 0;
+    }
+
+    /**
+     * Remove key. Returns 1 if it was present, after copying its value to
+     * *old (if old is not NULL), or 0 if it was not.
+     */
+    int remove(const Key& key, Value* old = NULL)
+    {
+        migrate();
+        Node** head;
+        Node** at = link(key, &head);
+        Node* node = *at;
+        if (!node) return 0;
+        if (old) *old = node->value;
+        *at = node->next;
+        release(node);
+        num_entries--;
+        return 1;
+    }
+
+    /**
+     * Add the n keys, none of which may be in the table already, all with the
+     * same value. Returns 0, or -1 if memory ran out and nothing was added.
+     */
+    int insert_run(const Key* keys, unsigned n, const Value& value)
+    {
+        return insert_block(keys, &value, 0, n);
+    }
+
+    /**
+     * Add the n keys, none of which may be in the table already, with
+     * values[i] for keys[i]. Returns 0, or -1 if memory ran out and nothing
+     * was added.
+     */
+    int insert_array(const Key* keys, const Value* values, unsigned n)
+    {
+        return insert_block(keys, values, 1, n);
+    }
+
+    /**
+     * Make room for n more entries. With max_load set, the table starts
+     * growing to enough buckets to hold them in one grow, rather than
+     * doubling a step at a time; the entries move across incrementally as
+     * for any other grow.
+     */
+    void reserve(unsigned n)
+    {
+        if (!max_load) return;
+        unsigned want = num_buckets;
+        while (num_entries + n > max_load * want) want = want * 2 + 1;
+        if (want > next_num_buckets) next_num_buckets = want;
+        if (!old_buckets && next_num_buckets > num_buckets) grow();
+    }
+
+    /**
+     * Remove every entry.
+     */
+    void clear()
+    {
+        for (unsigned i = migrated; i < old_num_buckets; i++) free_chain(old_buckets[i]);
+        free(old_buckets);
+        old_buckets = NULL;
+        old_num_buckets = migrated = 0;
+        for (unsigned i = 0; buckets && i < num_buckets; i++) {
+            free_chain(buckets[i]);
+            buckets[i] = NULL;
+        }
+        while (Block* b = blocks) {                             // entries from bulk loads go with their blocks
+            blocks = b->next;
+            free(b);
+        }
+        spare = NULL;
+        num_entries = 0;
+        next_num_buckets = 0;
+    }
+
+    /**
+     * Call visit(key, value) for every entry, in bucket order. visit must not
+     * call find, insert or remove, since they may move entries.
+     */
+    template <typename Visit>
+    void for_each(Visit visit)
+    {
+        for (unsigned i = migrated; i < old_num_buckets; i++) {
+            for (Node* node = old_buckets[i]; node; node = node->next) visit(node->key, node->value);
+        }
+        for (unsigned i = 0; i < num_buckets; i++) {
+            for (Node* node = buckets[i]; node; node = node->next) visit(node->key, node->value);
+        }
+    }
+
+    unsigned size() const { return num_entries; }
+    unsigned bucket_count() const { return num_buckets; }
+
+    /**
+     * Returns true while entries are being moved to a larger bucket array.
+     */
+    bool growing() const { return old_buckets != NULL; }
+
+    /**
+     * As getHashTableStats. While the table is growing, buckets is the size
+     * of the new array and the chains of both arrays are counted.
+     */
+    void stats(HashTableStats* st) const
+    {
+        st->entries = num_entries;
+        st->buckets = num_buckets;
+        st->used_buckets = 0;
+        st->max_chain = 0;
+        for (unsigned i = migrated; i < old_num_buckets; i++) count_chain(old_buckets[i], st);
+        for (unsigned i = 0; i < num_buckets; i++) count_chain(buckets[i], st);
+        st->peak_chain = peak_chain;
+        st->lookups = lookups;
+        st->probes = probes;
+    }
+
+    /**
+     * As resetHashTableStats.
+     */
+    void reset_stats()
+    {
+        peak_chain = 0;
+        lookups = 0;
+        probes = 0;
+    }
+
+private:
+    struct Node {
+        Key key;
+        Value value;
+        Node* next;
+    };
+
+    /**
+     * Entries allocated together by a bulk load.
+     */
+    struct Block {
+        Block* next;
+        unsigned count;
+        Node nodes[1];                      // count of them
+    };
+
+    /**
+     * Shared by insert_run and insert_array: values advance by step. Each
+     * entry goes in whichever array link would look for it in, and the chain
+     * it joins counts toward peak_chain as for insert.
+     */
+    int insert_block(const Key* keys, const Value* values, unsigned step, unsigned n)
+    {
+        if (!n) return 0;
+        migrate();
+        Block* b = (Block*) malloc(sizeof(Block) + (n - 1) * sizeof(Node));
+        if (!b) return -1;
+        reserve(n);
+        b->next = blocks;
+        b->count = n;
+        blocks = b;
+        for (unsigned i = 0; i < n; i++, values += step) {
+            Node* node = &b->nodes[i];
+            node->key = keys[i];
+            node->value = *values;
+            Node** head = chain(hasher(keys[i]));
+            node->next = *head;
+            *head = node;
+            unsigned len = 0;
+            for (; node; node = node->next) len++;
+            if (len > peak_chain) peak_chain = len;
+        }
+        num_entries += n;
+        return 0;
+    }
+
+    /**
+     * Returns true if node was allocated as part of a block.
+     */
+    bool in_block(const Node* node) const
+    {
+        for (const Block* b = blocks; b; b = b->next) {
+            if (node >= b->nodes && node < b->nodes + b->count) return true;
+        }
+        return false;
+    }
+
+    /**
+     * Free a removed entry, or keep it for reuse if it belongs to a block.
+     */
+    void release(Node* node)
+    {
+        if (in_block(node)) {
+            node->next = spare;
+            spare = node;
+        } else {
+            free(node);
+        }
+    }
+
+    /**
+     * The link that points to key's entry, or to the NULL at the end of its
+     * chain if it is not present; *head is set to the head of the chain.
+     * Counts one lookup and its probes.
+     */
+    Node** link(const Key& key, Node*** head)
+    {
+        Node** at = chain(hasher(key));
+        *head = at;
+        lookups++;
+        for (; *at; at = &(*at)->next) {
+            probes++;
+            if (equal((*at)->key, key)) break;
+        }
+        return at;
+    }
+
+    /**
+     * The head of the chain for hash h: in the old array if its bucket there
+     * has not been moved yet, otherwise in the new one.
+     */
+    Node** chain(unsigned h)
+    {
+        if (old_buckets && h % old_num_buckets >= migrated) return &old_buckets[h % old_num_buckets];
+        return &buckets[h % num_buckets];
+    }
+
+    /**
+     * Start growing to 2n+1 buckets, or more if reserve asked for more. If
+     * the new array cannot be allocated the table just stays the size it is.
+     */
+    void grow()
+    {
+        unsigned n = num_buckets * 2 + 1;
+        if (next_num_buckets > n) n = next_num_buckets;
+        Node** b = (Node**) calloc(n, sizeof(Node*));
+        if (!b) return;
+        old_buckets = buckets;
+        old_num_buckets = num_buckets;
+        migrated = 0;
+        buckets = b;
+        num_buckets = n;
+        next_num_buckets = 0;
+    }
+
+    /**
+     * Move up to HASH_MAP_MIGRATE old buckets into the new array, and free
+     * the old array once it is empty. A reserve made while this grow was
+     * under way starts the next one then.
+     */
+    void migrate()
+    {
+        if (!old_buckets) return;
+        for (int k = 0; k < HASH_MAP_MIGRATE && migrated < old_num_buckets; k++, migrated++) {
+            while (Node* node = old_buckets[migrated]) {
+                old_buckets[migrated] = node->next;
+                Node** head = &buckets[hasher(node->key) % num_buckets];
+                node->next = *head;
+                *head = node;
+            }
+        }
+        if (migrated == old_num_buckets) {
+            free(old_buckets);
+            old_buckets = NULL;
+            old_num_buckets = migrated = 0;
+            if (next_num_buckets > num_buckets) grow();
+        }
+    }
+
+    void free_chain(Node* node)
+    {
+        while (node) {
+            Node* next = node->next;
+            if (!in_block(node)) free(node);
+            node = next;
+        }
+    }
+
+    static void count_chain(Node* node, HashTableStats* st)
+    {
+        unsigned chain = 0;
+        for (; node; node = node->next) chain++;
+        if (chain) st->used_buckets++;
+        if (chain > st->max_chain) st->max_chain = chain;
+    }
+
+    HashMap(const HashMap&);                // not copyable
+    HashMap& operator=(const HashMap&);
+
+    Hasher hasher;
+    Equal equal;
+    Node** buckets;
+    unsigned num_buckets;
+    unsigned num_entries;
+    Node** old_buckets;                     // the array being moved out of while growing, or NULL
+    unsigned old_num_buckets;
+    unsigned migrated;                      // old buckets already moved
+    unsigned next_num_buckets;              // size reserve wants the next grow to reach, or 0
+    unsigned max_load;                      // entries per bucket before growing; 0 never grows
+    Block* blocks;                          // from bulk loads, newest first
+    Node* spare;                            // removed entries from blocks, for reuse
+    unsigned peak_chain;
+    unsigned long lookups, probes;
+};
+
+#endif // HASH_MAP_H
@@ -64,6 +64,7 @@ Naming conventions in this file:
 ***************************************************************************/
 #include <stdlib.h>   // For malloc and free
 #include <stdio.h>    // For printf
+#include "hash_map.h" // The table itself
 
 
 /****************************************************************************
@@ -74,91 +75,52 @@ Naming conventions in this file:
 * available everywhere and user code can hold pointers to these structs.
 ***************************************************************************/
 /**
- * This structure represents an a hash table.
- * Use "HashTable" instead when you are creating a new variable. [See top comments]
+ * Adapts a HashFunction to HashMap. The function already returns a bucket
+ * index, so HashMap's modulo leaves it unchanged.
  */
-struct _HashTable {
-    /** The array of pointers to the head of a singly linked list, whose nodes
-        are HashTableEntry objects */
-    HashTableEntry** buckets;
-
-    /** The hash function pointer */
+struct FunctionHash {
     HashFunction hash;
-
-    /** The number of buckets in the hash table */
-    unsigned int num_buckets;
+    unsigned int operator()(unsigned int key) const { return hash(key); }
 };
 
 /**
- * This structure represents a hash table entry.
- * Use "HashTableEntry" instead when you are creating a new variable. [See top comments]
+ * This structure represents an a hash table: a HashMap of void* values.
+ * Use "HashTable" instead when you are creating a new variable. [See top comments]
  */
-struct _HashTableEntry {
-    /** The key for the hash table entry */
-    unsigned int key;
+struct _HashTable {
+    /** The table itself */
+    HashMap<unsigned int, void*, FunctionHash> map;
 
-    /** The value associated with this hash table entry */
-    void* value;
+    _HashTable(HashFunction hash, unsigned int numBuckets) : map(numBuckets, 0, makeHash(hash)) {}
 
-    /**
-    * A pointer pointing to the next hash table entry
-    * NULL means there is no next entry (i.e. this is the tail)
-    */
-    HashTableEntry* next;
+    static FunctionHash makeHash(HashFunction hash)
+    {
+        FunctionHash h;
+        h.hash = hash;
+        return h;
+    }
 };
 
-
-/****************************************************************************
-* Private Functions
-*
-* These functions are not available outside of this file, since they are not
-* declared in hash_table.h.
-***************************************************************************/
 /**
-* createHashTableEntry
-*
-* Helper function that creates a hash table entry by allocating memory for it on
-* the heap. It initializes the entry with key and value, initialize pointer to
-* the next entry as NULL, and return the pointer to this hash table entry.
-*
-* @param key The key corresponds to the hash table entry
-* @param value The value stored in the hash table entry
-* @return The pointer to the hash table entry
-*/
-static HashTableEntry* createHashTableEntry(unsigned int key, void* value)
-{
-    HashTableEntry* HTentry = (HashTableEntry*)malloc(sizeof(HashTableEntry));
-    HTentry->key = key;                                                   // key
-    HTentry->value = value;                                               // value tied to key
-    HTentry->next = NULL;                                                 // next entry is defined null
-    return HTentry;
-}
+ * Adapts an ItemVisitor and its context to HashMap::for_each.
+ */
+struct VisitItem {
+    ItemVisitor visit;
+    void* context;
+    void operator()(const unsigned int& key, void*& value) const { visit(key, value, context); }
+};
 
 /**
-* findItem
-*
-* Helper function that checks whether there exists the hash table entry that
-* contains a specific key.
-*
-* @param hashTable The pointer to the hash table.
-* @param key The key corresponds to the hash table entry
-* @return The pointer to the hash table entry, or NULL if key does not exist
-*/
-static HashTableEntry* findItem(HashTable* hashTable, unsigned int key)
+ * freeValue
+ *
+ * Helper function for destroyHashTable: frees one value stored in the table.
+ */
+static void freeValue(unsigned int, void* value, void*)
 {
-    unsigned int i = hashTable->hash(key);                                // i = bucket index
-    HashTableEntry* thisNode = hashTable->buckets[i];                     // thisNode points to item
-    while(thisNode) {                                                     // while thisNode is not null
-        if(thisNode->key == key) {                                        // if thisNode lookdown key equals key
-            return thisNode;                                              // return thisNode
-        }
-        thisNode = thisNode->next;                                        // else go to next entry
-    }
-    return thisNode;
+    if(value) free(value);
 }
 
 
-
 /****************************************************************************
 * Public Interface Functions
 *
@@ -166,7 +128,6 @@ static HashTableEntry* findItem(HashTable* hashTable, unsigned int key)
 * file, and make use of the private functions and hidden definitions in the
 * above sections.
 ****************************************************************************/
-// The createHashTable is provided for you as a starting point.
 HashTable* createHashTable(HashFunction hashFunction, unsigned int numBuckets)
 {
     // The hash table has to contain at least one bucket. Exit gracefully if
@@ -175,97 +136,61 @@ HashTable* createHashTable(HashFunction hashFunction, unsigned int numBuckets)
         printf("Hash table has to contain at least 1 bucket...\n");
         exit(1);
     }
-
-    // Allocate memory for the new HashTable struct on heap.
-    HashTable* newTable = (HashTable*)malloc(sizeof(HashTable));
-
-    // Initialize the components of the new HashTable struct.
-    newTable->hash = hashFunction;
-    newTable->num_buckets = numBuckets;
-    newTable->buckets = (HashTableEntry**)malloc(numBuckets*sizeof(HashTableEntry*));
-
-    // As the new buckets contain indeterminant values, init each bucket as NULL.
-    unsigned int i;
-    for (i=0; i<numBuckets; ++i) {
-        newTable->buckets[i] = NULL;
-    }
-
-    // Return the new HashTable struct.
-    return newTable;
+    return new HashTable(hashFunction, numBuckets);
 }
 
 void destroyHashTable(HashTable* hashTable)
 {
-    HashTableEntry* Temp;
-    HashTableEntry* Temp2;
-    for(int i = 0; i < (hashTable->num_buckets); i++) {                   // parse through and free all items
-        Temp = hashTable->buckets[i];
-        Temp2 = Temp;
-        while(Temp) {                                                     // free item and its value
-            Temp2 = Temp;
-            Temp = Temp->next;
-            if(Temp2->value) {
-                free(Temp2->value);
-            }
-            free(Temp2);
-        }
-    }
-    free(hashTable->buckets);                                             // free buckets
-    free(hashTable);                                                      // free table
+    forEachItem(hashTable, freeValue, NULL);                              // free the values, then the entries and buckets
+    delete hashTable;
 }
 
 void* insertItem(HashTable* hashTable, unsigned int key, void* value)
 {
-    unsigned int i = hashTable->hash(key);
-    HashTableEntry* thisItem = findItem(hashTable, key);                  // find item given key
-    if(thisItem) {                                                        // case 1 - if item already exists, replace existing value
-        void* prevValue;
-        prevValue = thisItem->value;
-        thisItem->value = value;                                          // overwrite previous value
-        return prevValue;                                                 // return previous value
-    }
-    HashTableEntry* newItem = createHashTableEntry(key, value);
-    if(!newItem) return NULL;                                             // case 2 - else if item doesn't exist, create new Hash Table entry
-    newItem->next = hashTable->buckets[i];
-    hashTable->buckets[i] = newItem;
-    return NULL;
+    void* prevValue = NULL;
+    hashTable->map.insert(key, value, &prevValue);                        // previous value if overwritten
+    return prevValue;
+}
+
+int insertItems(HashTable* hashTable, const unsigned int* keys, void* const* values, unsigned int n)
+{
+    return hashTable->map.insert_array(keys, values, n);                  // one block, no duplicate check
 }
 
 void* getItem(HashTable* hashTable, unsigned int key)
 {
-    HashTableEntry* thisItem = findItem(hashTable,key);                   // find item
-    if(thisItem) return thisItem->value;                                  // if item exists, return it
+    void** value = hashTable->map.find(key);
+    if(value) return *value;                                              // if item exists, return it
     return NULL;                                                          // else return NULL
 }
 
 void* removeItem(HashTable* hashTable, unsigned int key)
 {
-    unsigned int i = hashTable->hash(key);                                // bucket index
-    HashTableEntry* thisNode = hashTable->buckets[i];
-    if(!thisNode) return NULL;                                            // if item is null return null
-    HashTableEntry* nextNode;
-    void* itemValue;
-    if(thisNode->key == key) {                                            // if current item is item you are looking for
-        itemValue = thisNode->value;                                      // store value
-        hashTable->buckets[i] =  thisNode->next;                          // stitch next item
-        free(thisNode);                                                   // free old item
-        return itemValue;                                                 // return stored value
-    }
-    while(thisNode->next) {                                               // keep going to next item
-        if(thisNode->next->key == key) {                                  // look for item whose key matches desired key
-            nextNode = thisNode->next;                                    // store item
-            itemValue = nextNode->value;                                  // store value
-            thisNode->next = thisNode->next->next;                        // stitch next next item as next item
-            free(nextNode);                                               // free next item
-            return itemValue;                                             // return stored value
-        }
-        thisNode = thisNode->next;                                        // go to next node and repeat while loop
-    }
-    return NULL;                                                          // return NULL if key not found
+    void* itemValue = NULL;
+    hashTable->map.remove(key, &itemValue);                               // value if the key was there
+    return itemValue;
 }
 
 void deleteItem(HashTable* hashTable, unsigned int key)
 {
     void* item = removeItem(hashTable,key);                               // call removeItem to free item
     free(item);                                                           // also free items value
-}
\ No newline at end of file
+}
+
+void getHashTableStats(HashTable* hashTable, HashTableStats* stats)
+{
+    hashTable->map.stats(stats);
+}
+
+void resetHashTableStats(HashTable* hashTable)
+{
+    hashTable->map.reset_stats();
+}
+
+void forEachItem(HashTable* hashTable, ItemVisitor visit, void* context)
+{
+    VisitItem v;
+    v.visit = visit;
+    v.context = context;
+    hashTable->map.for_each(v);
+}
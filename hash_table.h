@@ -111,6 +111,22 @@ void* getItem(HashTable* myHashTable, unsigned int key);
  */
 void* removeItem(HashTable* myHashTable, unsigned int key);
 
+/**
+ * insertItems
+ *
+ * Insert n items at once, with values[i] stored for keys[i]. None of the keys
+ * may be in the hash table already. This skips the check for an existing
+ * item that insertItem makes and allocates all the entries in one block, so it
+ * is much faster for building a table.
+ *
+ * @param myHashTable The pointer to the hash table.
+ * @param keys The keys of the new items.
+ * @param values The values to be stored for them.
+ * @param n The number of items.
+ * @return 0, or -1 if memory ran out and nothing was inserted
+ */
+int insertItems(HashTable* myHashTable, const unsigned int* keys, void* const* values, unsigned int n);
+
 /**
  * deleteItem
  *
@@ -124,4 +140,72 @@ void* removeItem(HashTable* myHashTable, unsigned int key);
  */
 void deleteItem(HashTable* myHashTable, unsigned int key);
 
+/**
+ * This defines a type that is a pointer to a function which is called by
+ * forEachItem with the key and value of an item, and the context pointer that
+ * was passed to forEachItem.
+ */
+typedef void (*ItemVisitor)(unsigned int key, void* value, void* context);
+
+/**
+ * forEachItem
+ *
+ * Call visit once for every item in the hash table, in no particular order.
+ * This takes time in proportion to the number of items and buckets. visit
+ * must not insert, get or remove items.
+ *
+ * @param myHashTable The pointer to the hash table.
+ * @param visit The function to call for each item.
+ * @param context Passed on to visit.
+ */
+void forEachItem(HashTable* myHashTable, ItemVisitor visit, void* context);
+
+/**
+ * A snapshot of the load and collision statistics of a hash table.
+ */
+typedef struct {
+    /** The number of entries in the table */
+    unsigned int entries;
+
+    /** The number of buckets, and how many of them hold at least one entry */
+    unsigned int buckets;
+    unsigned int used_buckets;
+
+    /** The longest chain now, and the longest one has been since the last reset */
+    unsigned int max_chain;
+    unsigned int peak_chain;
+
+    /**
+     * The number of key searches (by getItem, insertItem and removeItem) since
+     * the last reset, and the number of entries they compared in total
+     */
+    unsigned long lookups;
+    unsigned long probes;
+} HashTableStats;
+
+/**
+ * getHashTableStats
+ *
+ * Fill in stats for the hash table. The counters are kept up to date by every
+ * operation at the cost of an increment or two; used_buckets and max_chain
+ * are found here by walking the chains, so this takes time in proportion to
+ * the number of entries.
+ *
+ * The mean chain length over used buckets is entries / used_buckets, and the
+ * mean number of entries compared per lookup is probes / lookups.
+ *
+ * @param myHashTable The pointer to the hash table.
+ * @param stats The statistics to fill in.
+ */
+void getHashTableStats(HashTable* myHashTable, HashTableStats* stats);
+
+/**
+ * resetHashTableStats
+ *
+ * Start counting lookups, probes and the peak chain length afresh.
+ *
+ * @param myHashTable The pointer to the hash table.
+ */
+void resetHashTableStats(HashTable* myHashTable);
+
 #endif
\ No newline at end of file
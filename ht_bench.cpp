@@ -0,0 +1,327 @@
+#include "ht_bench.h"
+
+#include "map_size.h"
+#include "map.h"
+#include "hash_map.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <time.h>
+#else
+#include "mbed.h"
+#endif
+
+#define NUM_KEYSETS 4
+#define NUM_HASHES  3
+#define NUM_SIZES   4
+#define MAX_BUCKETS 1021
+
+typedef HashMap<unsigned, MapItem, MapHash> MapTable;                         // as in map.cpp
+
+static const char* const keyset_names[NUM_KEYSETS] = {"map1", "map2", "seq", "random"};
+static const char* const hash_names[NUM_HASHES] = {"mod", "mul", "mix"};
+static const unsigned sizes[NUM_SIZES] = {NUMBUCKETS, 61, 251, MAX_BUCKETS};
+
+static unsigned* keys;
+static unsigned* misses;
+static int num_keys;
+static unsigned num_buckets;                // read by the hash functions
+static unsigned short chain[MAX_BUCKETS];   // chain length per bucket
+static volatile uintptr_t sink;             // keeps lookups from being optimised away
+
+/**
+ * The hash functions under test. HashFunction takes only the key, so the
+ * bucket count comes from num_buckets.
+ */
+static unsigned hash_mod(unsigned key)
+{
+    return key % num_buckets;
+}
+
+static unsigned scale(uint32_t h)
+{
+    return (unsigned)(((uint64_t)h * num_buckets) >> 32);
+}
+
+static unsigned hash_mul(unsigned key)
+{
+    return scale(key * 2654435761u);
+}
+
+static unsigned hash_mix(unsigned key)
+{
+    uint32_t h = key;                                                           // murmur3 finaliser
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return scale(h);
+}
+
+static const HashFunction hashes[NUM_HASHES] = {hash_mod, hash_mul, hash_mix};
+
+/**
+ * Wall clock in nanoseconds (microsecond resolution on the board).
+ */
+static uint64_t wall_ns()
+{
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return (uint64_t)us_ticker_read() * 1000;
+#endif
+}
+
+/**
+ * Fill keys[] with key set k, at most max keys, and misses[] with as many keys
+ * that are not in it.
+ */
+static void make_keys(int k, int max)
+{
+    int n = 0;
+    unsigned seed = 1;
+    switch (k) {
+        case 0:                                                                 // XY_KEY = x*h + y over each map
+        case 1: {
+            int w = k ? WIDTH2 : WIDTH1, h = k ? HEIGHT2 : HEIGHT1;
+            for (int x = 0; x < w && n < max; x++) {
+                for (int y = 0; y < h && n < max; y++) keys[n++] = x*h + y;
+            }
+            break;
+        }
+        case 2:
+            for (; n < max; n++) keys[n] = n;
+            break;
+        default:
+            while (n < max) {
+                seed = seed * 1103515245 + 12345;
+                unsigned key = seed >> 4;
+                int dup = 0;
+                for (int i = 0; i < n && !dup; i++) dup = keys[i] == key;
+                if (!dup) keys[n++] = key;
+            }
+            break;
+    }
+    num_keys = n;
+    for (int i = 0; i < n; i++) misses[i] = keys[i] + 0x10000000;
+}
+
+/**
+ * Compute chain[] for the current keys under hash h. Returns the longest.
+ */
+static int chains(HashFunction h)
+{
+    for (unsigned b = 0; b < num_buckets; b++) chain[b] = 0;
+    int longest = 0;
+    for (int i = 0; i < num_keys; i++) {
+        int len = ++chain[h(keys[i])];
+        if (len > longest) longest = len;
+    }
+    return longest;
+}
+
+/**
+ * Mean chain length over non-empty buckets, and the mean entries compared by
+ * a hit (the key's position in its chain, averaged) and by a miss (the whole
+ * chain of the bucket the missing key hashes to), all in hundredths.
+ */
+static void probes(HashFunction h, long* mean, long* hit, long* miss)
+{
+    long used = 0, hit_sum = 0, miss_sum = 0;
+    for (unsigned b = 0; b < num_buckets; b++) {
+        if (chain[b]) used++;
+        hit_sum += (long)chain[b] * (chain[b] + 1) / 2;
+    }
+    for (int i = 0; i < num_keys; i++) miss_sum += chain[h(misses[i])];
+    *mean = used ? (long)num_keys * 100 / used : 0;
+    *hit = num_keys ? hit_sum * 100 / num_keys : 0;
+    *miss = num_keys ? miss_sum * 100 / num_keys : 0;
+}
+
+static long per_op(uint64_t ns, long ops)
+{
+    return ops ? (long)(ns / ops) : 0;
+}
+
+/**
+ * Time the table operations for the current keys under hash h and print the
+ * first table's line.
+ */
+static void run(int k, int hi)
+{
+    HashFunction h = hashes[hi];
+    int longest = chains(h);
+    long mean, hit, miss;
+    probes(h, &mean, &hit, &miss);
+
+    HashTable* t = createHashTable(h, num_buckets);
+    uint64_t t0 = wall_ns();
+    for (int i = 0; i < num_keys; i++) insertItem(t, keys[i], NULL);
+    uint64_t t_insert = wall_ns() - t0;
+
+    t0 = wall_ns();
+    for (int r = 0; r < HT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < num_keys; i++) sink += (uintptr_t)getItem(t, keys[i]) + 1;
+    }
+    uint64_t t_hit = wall_ns() - t0;
+
+    t0 = wall_ns();
+    for (int r = 0; r < HT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < num_keys; i++) sink += (uintptr_t)getItem(t, misses[i]);
+    }
+    uint64_t t_miss = wall_ns() - t0;
+
+    t0 = wall_ns();
+    for (int i = 0; i < num_keys; i++) removeItem(t, keys[i]);
+    uint64_t t_remove = wall_ns() - t0;
+
+    for (int i = 0; i < num_keys; i++) insertItem(t, keys[i], NULL);
+    t0 = wall_ns();
+    destroyHashTable(t);
+    uint64_t t_destroy = wall_ns() - t0;
+
+    long lookups = (long)num_keys * HT_BENCH_ROUNDS;
+    printf("HashTable,%s,%s,%u,%d,%d,%ld.%02ld,%ld.%02ld,%ld.%02ld,%ld,%ld,%ld,%ld,%ld\r\n",
+           keyset_names[k], hash_names[hi], num_buckets, num_keys, longest,
+           mean / 100, mean % 100, hit / 100, hit % 100, miss / 100, miss % 100,
+           per_op(t_insert, num_keys), per_op(t_hit, lookups), per_op(t_miss, lookups),
+           per_op(t_remove, num_keys), per_op(t_destroy, num_keys));
+}
+
+/**
+ * Time the map tables' HashMap for the current keys and print its line of the
+ * first table: with num_buckets buckets that never grow, or with grow set,
+ * starting from NUMBUCKETS and growing at MAP_MAX_LOAD as the maps do. The
+ * chain and probe columns are counted by the table itself, and buckets is
+ * the count after the inserts.
+ */
+static int run_map(int k, int grow)
+{
+    MapTable* t = new MapTable(grow ? NUMBUCKETS : num_buckets, grow ? MAP_MAX_LOAD : 0);
+    if (!t || !t->ok()) {
+        delete t;
+        return -1;
+    }
+    MapItem item = {PLANT, NULL, 1, 0};
+    uint64_t t0 = wall_ns();
+    for (int i = 0; i < num_keys; i++) {
+        if (t->insert(keys[i], item) < 0) {
+            delete t;
+            return -1;
+        }
+    }
+    uint64_t t_insert = wall_ns() - t0;
+    for (int i = 0; i < num_keys; i++) {                                        // finish a grow still under way
+        sink += (uintptr_t)t->find(keys[i]);
+    }
+
+    HashTableStats st;
+    t->reset_stats();
+    t0 = wall_ns();
+    for (int r = 0; r < HT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < num_keys; i++) sink += (uintptr_t)t->find(keys[i]);
+    }
+    uint64_t t_hit = wall_ns() - t0;
+    t->stats(&st);
+    long hit = st.lookups ? (long)(st.probes * 100 / st.lookups) : 0;
+
+    t->reset_stats();
+    t0 = wall_ns();
+    for (int r = 0; r < HT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < num_keys; i++) sink += (uintptr_t)t->find(misses[i]);
+    }
+    uint64_t t_miss = wall_ns() - t0;
+    t->stats(&st);
+    long miss = st.lookups ? (long)(st.probes * 100 / st.lookups) : 0;
+    long mean = st.used_buckets ? (long)st.entries * 100 / st.used_buckets : 0;
+
+    t0 = wall_ns();
+    for (int i = 0; i < num_keys; i++) t->remove(keys[i]);
+    uint64_t t_remove = wall_ns() - t0;
+
+    for (int i = 0; i < num_keys; i++) t->insert(keys[i], item);
+    t0 = wall_ns();
+    delete t;
+    uint64_t t_destroy = wall_ns() - t0;
+
+    long lookups = (long)num_keys * HT_BENCH_ROUNDS;
+    printf("%s,%s,MapHash,%u,%d,%u,%ld.%02ld,%ld.%02ld,%ld.%02ld,%ld,%ld,%ld,%ld,%ld\r\n",
+           grow ? "HashMap_grow" : "HashMap", keyset_names[k], st.buckets, num_keys, st.max_chain,
+           mean / 100, mean % 100, hit / 100, hit % 100, miss / 100, miss % 100,
+           per_op(t_insert, num_keys), per_op(t_hit, lookups), per_op(t_miss, lookups),
+           per_op(t_remove, num_keys), per_op(t_destroy, num_keys));
+    return 0;
+}
+
+/**
+ * Print the histogram lines for the current keys under hash h.
+ */
+static void histogram(int k, int hi)
+{
+    int longest = chains(hashes[hi]);
+    for (int len = 0; len <= longest; len++) {
+        int count = 0;
+        for (unsigned b = 0; b < num_buckets; b++) count += chain[b] == len;
+        if (count) printf("%s,%s,%u,%d,%d\r\n", keyset_names[k], hash_names[hi], num_buckets, len, count);
+    }
+}
+
+int ht_bench(int max_keys)
+{
+    keys = (unsigned*) malloc(max_keys * sizeof(unsigned));
+    misses = (unsigned*) malloc(max_keys * sizeof(unsigned));
+    if (!keys || !misses) {
+        free(keys);
+        free(misses);
+        return -1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 0) printf("table,keys,hash,buckets,entries,max_chain,mean_chain,hit_probes,miss_probes,"
+                              "insert_ns,hit_ns,miss_ns,remove_ns,destroy_ns\r\n");
+        else printf("\r\nkeys,hash,buckets,chain_len,count\r\n");
+        for (int k = 0; k < NUM_KEYSETS; k++) {
+            make_keys(k, max_keys);
+            for (int hi = 0; hi < NUM_HASHES; hi++) {
+                for (int s = 0; s < NUM_SIZES; s++) {
+                    num_buckets = sizes[s];
+                    if (pass == 0) run(k, hi);
+                    else histogram(k, hi);
+                }
+            }
+            if (pass == 1) continue;
+            int failed = 0;
+            for (int s = 0; s < NUM_SIZES && !failed; s++) {
+                num_buckets = sizes[s];
+                failed = run_map(k, 0);
+            }
+            if (failed || run_map(k, 1)) {
+                free(keys);
+                free(misses);
+                return -1;
+            }
+        }
+    }
+    free(keys);
+    free(misses);
+    return 0;
+}
+
+#if defined(__linux__) && defined(HT_BENCH_MAIN)
+/**
+ * Host entry point:
+ *
+ *   g++ -O2 -DHT_BENCH_MAIN ht_bench.cpp hash_table.cpp
+ *   ./a.out [max_keys] > results.csv
+ */
+int main(int argc, char** argv)
+{
+    int max_keys = argc > 1 ? atoi(argv[1]) : WIDTH1 * HEIGHT1;
+    return ht_bench(max_keys) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef HT_BENCH_H
+#define HT_BENCH_H
+
+// Lookups timed per key, for the hit and miss tests
+#define HT_BENCH_ROUNDS     8
+
+/**
+ * Benchmark the HashTable over every combination of
+ *
+ *   key set:  map1 and map2 (XY_KEY of every tile of each map), seq
+ *             (0, 1, 2, ...) and random
+ *   hash:     mod (key % buckets), mul (multiplicative) and mix (a bit mixer,
+ *             then scaled)
+ *   buckets:  NUMBUCKETS (7), 61, 251 and 1021
+ *
+ * and the maps' own table, a HashMap of MapItems hashed with MapHash, for
+ * each key set: with each of those bucket counts and no growth, and starting
+ * from NUMBUCKETS and growing at MAP_MAX_LOAD as the maps do.
+ *
+ * Key sets are cut down to max_keys keys. Two CSV tables are printed to
+ * stdout (the pc serial port on the board). The first has one line per
+ * combination:
+ *
+ *   table,keys,hash,buckets,entries,max_chain,mean_chain,hit_probes,
+ *   miss_probes,insert_ns,hit_ns,miss_ns,remove_ns,destroy_ns
+ *
+ * where table is HashTable, HashMap or HashMap_grow, mean_chain is over
+ * non-empty buckets, hit_probes and miss_probes are the mean number of
+ * entries compared by a successful and an unsuccessful lookup, and the *_ns
+ * columns are the mean time per operation (destroy_ns per entry). HashTable
+ * lines compute the chain columns from the hash; HashMap lines take them
+ * from the table's own statistics, with buckets the count after the inserts.
+ * The second table is the HashTable chain length histogram:
+ *
+ *   keys,hash,buckets,chain_len,count
+ *
+ * with one line per chain length that occurs. Returns 0, or -1 if memory ran
+ * out.
+ */
+int ht_bench(int max_keys);
+
+#endif // HT_BENCH_H
@@ -0,0 +1,168 @@
+#include "io_worker.h"
+
+#include "mbed.h"
+#include "FATFileSystem.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/**
+ * Pending requests, oldest first. The request at head is the one being
+ * serviced; cur_fh holds its open file between io_poll calls.
+ */
+static IORequest* queue[IO_QUEUE_LEN];
+static int head, count;
+static FATFileSystem* io_fs;
+static FileHandle* cur_fh;
+
+#if defined(__linux__)
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int threaded;
+#define LOCK()      pthread_mutex_lock(&queue_lock)
+#define UNLOCK()    pthread_mutex_unlock(&queue_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/**
+ * Microseconds since an arbitrary start point, for the io_poll budget. Only
+ * differences are meaningful; unsigned subtraction keeps them right across
+ * the wrap every 71 minutes.
+ */
+static unsigned now_us()
+{
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned)ts.tv_sec * 1000000u + (unsigned)(ts.tv_nsec / 1000);
+#else
+    return us_ticker_read();
+#endif
+}
+
+/**
+ * Finish the request at the head of the queue with the given status.
+ */
+static void complete(int status)
+{
+    if (cur_fh) {
+        cur_fh->close();
+        cur_fh = NULL;
+    }
+    LOCK();
+    IORequest* req = queue[head];
+    head = (head + 1) % IO_QUEUE_LEN;
+    count--;
+    UNLOCK();
+    req->status = status;
+}
+
+/**
+ * Do one IO_CHUNK of work on the request at the head of the queue.
+ * Returns 0 if there was nothing to do.
+ */
+static int step()
+{
+    LOCK();
+    IORequest* req = count ? queue[head] : NULL;
+    UNLOCK();
+    if (!req) return 0;
+
+    if (!cur_fh) {                                                              // first step: open and seek
+        cur_fh = io_fs->open(req->name, O_RDONLY);
+        if (!cur_fh || cur_fh->lseek(req->offset, SEEK_SET) < 0) {
+            complete(IO_ERROR);
+            return 1;
+        }
+    }
+    int want = req->len - req->count;
+    if (want > IO_CHUNK) want = IO_CHUNK;
+    int got = cur_fh->read((char*)req->buf + req->count, want);
+    if (got < 0) {
+        complete(IO_ERROR);
+        return 1;
+    }
+    req->count += got;
+    if (got < want || req->count == req->len) complete(IO_DONE);                // done, or hit end of file
+    return 1;
+}
+
+void io_init(FATFileSystem* fs)
+{
+    io_fs = fs;
+}
+
+int io_submit_read(IORequest* req, const char* name, long offset, void* buf, int len)
+{
+    if (!io_fs) return -1;
+    LOCK();
+    if (count == IO_QUEUE_LEN) {
+        UNLOCK();
+        return -1;
+    }
+    req->name = name;
+    req->offset = offset;
+    req->buf = buf;
+    req->len = len;
+    req->count = 0;
+    req->status = IO_PENDING;
+    queue[(head + count) % IO_QUEUE_LEN] = req;
+    count++;
+#if defined(__linux__)
+    pthread_cond_signal(&queue_cond);
+#endif
+    UNLOCK();
+    return 0;
+}
+
+int io_poll(int budget_ms)
+{
+#if defined(__linux__)
+    if (threaded) return io_pending();                                          // the thread owns the queue
+#endif
+    if (budget_ms < 0) budget_ms = 0;
+    unsigned start = now_us();
+    while (step()) {
+        if (now_us() - start >= (unsigned)budget_ms * 1000u) break;
+    }
+    return io_pending();
+}
+
+int io_pending()
+{
+    LOCK();
+    int n = count;
+    UNLOCK();
+    return n;
+}
+
+#if defined(__linux__) && FFS_REENTRANT
+static void* worker(void* arg)
+{
+    while (1) {
+        LOCK();
+        while (!count) pthread_cond_wait(&queue_cond, &queue_lock);
+        UNLOCK();
+        while (step());
+    }
+    return NULL;
+}
+#endif
+
+int io_start_thread()
+{
+#if defined(__linux__) && FFS_REENTRANT
+    pthread_t t;
+    if (threaded) return 0;
+    if (pthread_create(&t, NULL, worker, NULL) != 0) return -1;
+    pthread_detach(t);
+    threaded = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
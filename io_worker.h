@@ -0,0 +1,62 @@
+#ifndef IO_WORKER_H
+#define IO_WORKER_H
+
+class FATFileSystem;
+
+/**
+ * A read request handed to the I/O worker. The caller owns the request and
+ * the buffer, and must keep both alive until status leaves IO_PENDING.
+ */
+typedef struct {
+    const char* name;       // File name, relative to the file system root
+    long offset;            // Byte offset to start reading from
+    void* buf;              // Destination buffer
+    int len;                // Number of bytes wanted
+    volatile int status;    // IO_IDLE, IO_PENDING, IO_DONE or IO_ERROR
+    volatile int count;     // Bytes actually read (short at end of file)
+} IORequest;
+
+// IORequest status values
+#define IO_IDLE     0
+#define IO_PENDING  1
+#define IO_DONE     2
+#define IO_ERROR    3
+
+// Maximum number of requests waiting at once
+#define IO_QUEUE_LEN    8
+
+// Bytes read per step of io_poll, so one step fits well inside a frame
+#define IO_CHUNK        512
+
+/**
+ * Attach the worker to a mounted file system. Requests submitted before this
+ * is called are rejected.
+ */
+void io_init(FATFileSystem* fs);
+
+/**
+ * Queue a read of len bytes at offset in the named file into buf. Returns 0
+ * if queued, or -1 if the queue is full or the worker has no file system.
+ */
+int io_submit_read(IORequest* req, const char* name, long offset, void* buf, int len);
+
+/**
+ * Service queued requests in IO_CHUNK steps until the queue is empty or
+ * budget_ms has passed. Meant for the spare time at the end of a frame.
+ * Returns the number of requests still pending.
+ */
+int io_poll(int budget_ms);
+
+/**
+ * Returns the number of requests queued or in progress.
+ */
+int io_pending();
+
+/**
+ * Service requests from a background thread instead of io_poll. Needs a
+ * thread-safe FatFs build (FFS_REENTRANT in ffconf.h); currently available
+ * on the Linux host only. Returns 0 on success, -1 otherwise.
+ */
+int io_start_thread();
+
+#endif // IO_WORKER_H
@@ -4,6 +4,12 @@
 #include "map.h"
 #include "graphics.h"
 #include "speech.h"
+#include "io_worker.h"
+#include "entity.h"
+#include "path.h"
+#include "script.h"
+#include "replay.h"
+#include "sim.h"
 
 #include "speaker.h"                                                            // added speaker.h file for speaker output
 
@@ -13,13 +19,15 @@ GameInputs in;
 int get_action (GameInputs inputs);                                             // what player does
 int update_game (int action);                                                   // game state function
 void draw_game (int init);                                                      // draw game function
-void init_main_map ();                                                          // initialize main map
-void init_sub_map ();                                                           // initialize second map
+void draw_cell (int i, int j);                                                  // redraw one on-screen tile
+void init_maps ();                                                              // define the maps
 int do_action(MapItem* item, int direction, int x, int y);                      // use action button
-void npcAction();                                                               // NPC dialogue progression
+void init_quest();                                                              // load the quest script
+void finish_quest();                                                            // switch to the SD card's quest once read
 int main ();
 void game_over();                                                               // game over screen
 void draw_start();                                                              // start screen
+int game_check(long frame);                                                     // check game state invariants
 
 Speaker mySpeaker(p26);                                                         // defined speaker with pin 26
 
@@ -126,6 +134,7 @@ int update_game(int action)
                 break;
             } else break;
         case ACTION_BUTTON:                                                     // ACTION_BUTTON input received, checks 4 tiles around player to determine what can be done
+            if(!map_query_radius(-1, Player.x, Player.y, 1, NULL, 0)) break;    // nothing next to the player
             action = do_action(get_north(Player.x,Player.y), 1, Player.x, Player.y);
             action = do_action(get_south(Player.x,Player.y), 2, Player.x, Player.y);
             action = do_action(get_east(Player.x,Player.y), 3, Player.x, Player.y);
@@ -157,7 +166,7 @@ int update_game(int action)
                 char *line2 = "use B1 to Place";
                 speech(line1, line2);
                 return FULL_DRAW;
-            } else if(Player.map == 1) {                                        // player can't use waypoint on maze
+            } else if(Player.map != 0) {                                        // player can't use waypoint off the main map
                 char *line1 = "No cheating! Go";
                 char *line2 = "through the maze!";
                 speech(line1, line2);
@@ -170,367 +179,225 @@ int update_game(int action)
     return NO_RESULT;
 }
 
-int do_action(MapItem *item, int direction, int x, int y)                       // function for determining what action button does depending on adjacent tile
+/**
+ * The built-in quest, used when the SD card has no quest.txt. See script.h for
+ * the format.
+ */
+static const char quest[] =
+    "on HEART\n"
+    "  erase\n"
+    "  say \"You feel the\" \"power surging!\"\n"
+    "  say \"within you!\" \"You now take\"\n"
+    "  say \"reduced damage\" \"from ghosts!\"\n"
+    "  set heart 1\n"
+    "  hud health\n"
+    "end\n"
+    "on ROCK key=1 or omni=1\n"
+    "  push\n"
+    "end\n"
+    "on ROCK key=0\n"
+    "  say \"You are not\" \"strong enough to\"\n"
+    "  say \"move this rock.\" \"Capture slimes!\"\n"
+    "end\n"
+    "on KEY\n"
+    "  set key 2\n"
+    "  erase\n"
+    "  say \"You got the Key!\" \"Talk to The Eye\"\n"
+    "end\n"
+    "on NPC progress=0\n"
+    "  say \"The Eye: Ah, a\" \"Traveller! I\"\n"
+    "  say \"have a small\" \"problem I could\"\n"
+    "  say \"use your help\" \"with. Capture\"\n"
+    "  say \"5 slimes from my\" \"dungeon. You can\"\n"
+    "  say \"get there by\" \"taking the portal\"\n"
+    "  say \"south of here\" \"Good Luck!\"\n"
+    "  set progress 1\n"
+    "end\n"
+    "on NPC progress=1 slimes=5 or progress=1 omni=1\n"
+    "  say \"Excellent work!\" \"You are now\"\n"
+    "  say \"strong enough to\" \"move rocks! Also,\"\n"
+    "  say \"could I ask for\" \"another favor?\"\n"
+    "  say \"Go through the\" \"portal and head\"\n"
+    "  say \"East. Move the\" \"rock and open\"\n"
+    "  say \"up the gate\" \"on the river.\"\n"
+    "  say \"You could also\" \"head towards \"\n"
+    "  say \"the NorthEast\" \"corner for a \"\n"
+    "  say \"treasure I \" \"uncovered...\"\n"
+    "  say \"I'll see you\" \"at the gate!\"\n"
+    "  set progress 2\n"
+    "  erase 13 21\n"
+    "  set key 1\n"
+    "end\n"
+    "on NPC progress=1 slimes<5\n"
+    "  say \"What are you\" \"waiting for? Go\"\n"
+    "  say \"get those slimes\" \"Traveller!\"\n"
+    "end\n"
+    "on NPC progress=2 key=2 or progress=2 omni=1\n"
+    "  set key 2\n"
+    "  say \"Impressive! I\" \"knew that I could\"\n"
+    "  say \"trust you to get\" \"my keys! Come \"\n"
+    "  say \"inside for \" \"your reward!\"\n"
+    "  erase 31 43\n"
+    "  add NPC 45 43\n"
+    "  set progress 3\n"
+    "end\n"
+    "on NPC progress=2 key=1\n"
+    "  say \"I dropped my keys\" \"and now I can't\"\n"
+    "  say \"get inside my \" \"house... Could\"\n"
+    "  say \"you get them for\" \"me? They are\"\n"
+    "  say \"outside the north\" \"part of my house.\"\n"
+    "  say \"Watch out for the\" \"ghosts,they hurt!\"\n"
+    "  hud lives\n"
+    "end\n"
+    "on NPC progress=3\n"
+    "  win\n"
+    "end\n"
+    "on GATE1 key=1 or omni=1\n"
+    "  erase\n"
+    "  say \"Gate unlocked!\" \"Talk to The Eye\"\n"
+    "end\n"
+    "on GATE1\n"
+    "  say \"This gate is\" \"locked.\"\n"
+    "end\n"
+    "on GATE2 key=2 progress=3 or omni=1\n"
+    "  erase\n"
+    "  say \"Door unlocked!\" \"Talk to The Eye\"\n"
+    "end\n"
+    "on GATE2 key=2 progress=2\n"
+    "  say \"Better give the\" \"keys back first.\"\n"
+    "end\n"
+    "on GATE2\n"
+    "  say \"This door is\" \"locked.\"\n"
+    "end\n"
+    "on SLIME slimes<=5 or omni=1\n"
+    "  erase\n"
+    "  inc slimes\n"
+    "  hud slimes\n"
+    "end\n"
+    "portal 0 5 45 to 1 15 22 progress=1 or omni=1\n"
+    "  hud slimes\n"
+    "end\n"
+    "on PORTAL map=0 progress=0\n"
+    "  say \"Talk to The Eye\" \"north of here\"\n"
+    "end\n"
+    "on PORTAL map=0\n"
+    "  say \"Head East to \" \"the gate\"\n"
+    "end\n"
+    "portal 1 16 21 to 0 5 43 slimes=5 progress=2 or omni=1\n"
+    "  add NPC 31 43\n"
+    "  erase 6 5\n"
+    "  hud noslimes\n"
+    "end\n"
+    "on PORTAL map=1 slimes<5\n"
+    "  say \"Capture 5 slimes!\" \"\"\n"
+    "end\n"
+    "on PORTAL map=1\n"
+    "  say \"Talk to The Eye\" \"\"\n"
+    "end\n";
+
+/**
+ * A quest on the SD card replaces the built-in one. The I/O worker reads it
+ * while the start screen is drawn, and it is compiled before the first frame.
+ */
+#define QUEST_FILE  "quest.txt"
+#define QUEST_MAX   4096                                                        // quest files must be shorter than this, in bytes
+static IORequest quest_req;
+static char* quest_buf;
+
+static void hud_slimes()
 {
-    char *line1;
-    char *line2;
-    switch(item->type) {                                                        // switch statement inspects type of mapitem
-        case HEART:                                                             // HEART is item that reduces damage taken by ghosts from 20 to 10 per 100ms
-            if(direction == 1) {                                                // all directions are checked so wrong tile isn't cleared
-                map_erase(x, y-1);
-            } else if(direction == 2) {
-                map_erase(x, y+1);
-            } else if(direction == 3) {
-                map_erase(x+1, y);
-            } else if(direction == 4) {
-                map_erase(x-1, y);
-            }
-            line1 = "You feel the";
-            line2 = "power surging!";
-            speech(line1, line2);
-            line1 = "within you!";
-            line2 = "You now take";
-            speech(line1, line2);
-            line1 = "reduced damage";
-            line2 = "from ghosts!";
-            speech(line1, line2);
-            Player.has_heart = 1;
-            draw_lower_status(Player.health, Player.has_heart);                 // health bar is updated to blue color once powerup picked up
-            draw_game(FULL_DRAW);
-            return FULL_DRAW;
-        case ROCK:                                                              // ROCK is moveable to walkable tiles after player completes quest 1
-            if(Player.has_key == 1 || Player.omni_mode) {
-                if(direction == 1) {                                            // all directions are checked to make sure rock can move
-                    if(get_north(Player.x, Player.y-1)->walkable == false) return NO_RESULT;
-                    else {
-                        map_erase(Player.x, Player.y-2);
-                        map_erase(Player.x, Player.y-1);
-                        add_rock(Player.x, Player.y-2);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    }
-                } else if(direction == 2) {
-                    if(get_south(Player.x, Player.y+1)->walkable == false) return NO_RESULT;
-                    else {
-                        map_erase(Player.x, Player.y+2);
-                        map_erase(Player.x, Player.y+1);
-                        add_rock(Player.x, Player.y+2);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    }
-                } else if(direction == 3) {
-                    if(get_east(Player.x+1, Player.y)->walkable == false) return NO_RESULT;
-                    else {
-                        map_erase(Player.x+2, Player.y);
-                        map_erase(Player.x+1, Player.y);
-                        add_rock(Player.x+2, Player.y);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    }
-                } else if(direction == 4) {
-                    if(get_east(Player.x-1, Player.y)->walkable == false) return NO_RESULT;
-                    else {
-                        map_erase(Player.x-2, Player.y);
-                        map_erase(Player.x-1, Player.y);
-                        add_rock(Player.x-2, Player.y);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    }
-                }
-            } else if(Player.has_key == 0) {                                    // if player has not completed quest 1, they cannot move the rock
-                line1 = "You are not";
-                line2 = "strong enough to";
-                speech(line1, line2);
-                line1 = "move this rock.";
-                line2 = "Capture slimes!";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            }
-            return FULL_DRAW;
-        case KEY:                                                               // if item is key, key is removed and Player.has_key is incremented
-            Player.has_key = 2;
-            if(direction == 1) {                                                // all directions are checked so wrong tile isn't cleared
-                map_erase(x, y-1);
-            } else if(direction == 2) {
-                map_erase(x, y+1);
-            } else if(direction == 3) {
-                map_erase(x+1, y);
-            } else if(direction == 4) {
-                map_erase(x-1, y);
-            }
-            line1 = "You got the Key!";
-            line2 = "Talk to The Eye";
-            speech(line1, line2);
-            draw_game(FULL_DRAW);
-            return FULL_DRAW;
-        case NPC:                                                               // if item is NPC, npcAction is called for various quest dialogue
-            npcAction();
-            draw_game(FULL_DRAW);
-            return FULL_DRAW;
-        case GATE1:                                                             // if item is GATE1, tile will be erased if player has completed quest 1
-            if(Player.has_key == 1 || Player.omni_mode) {                       // or if omni_mode enabled
-                if(direction == 1) {
-                    map_erase(x, y-1);
-                } else if(direction == 2) {
-                    map_erase(x, y+1);
-                } else if(direction == 3) {
-                    map_erase(x+1, y);
-                } else if(direction == 4) {
-                    map_erase(x-1, y);
-                }
-                line1 = "Gate unlocked!";
-                line2 = "Talk to The Eye";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            } else {                                                            // otherwise player must complete quest 1
-                line1 = "This gate is";
-                line2 = "locked.";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            }
-        case GATE2:                                                             // if item is GATE2, player can't open until quest 2 complete and NPC dialogue has progressed
-            if((Player.has_key == 2 && Player.NPCprogress == 3)|| Player.omni_mode) { // or if omni_mode enabled
-                if(direction == 1) {
-                    map_erase(x, y-1);
-                } else if(direction == 2) {
-                    map_erase(x, y+1);
-                } else if(direction == 3) {
-                    map_erase(x+1, y);
-                } else if(direction == 4) {
-                    map_erase(x-1, y);
-                }
-                line1 = "Door unlocked!";
-                line2 = "Talk to The Eye";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            } else if(Player.has_key == 2 && Player.NPCprogress == 2) {         // else player must talk to NPC first
-                line1 = "Better give the";
-                line2 = "keys back first.";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            } else {                                                            // else player must get quest instructions
-                line1 = "This door is";
-                line2 = "locked.";
-                speech(line1, line2);
-                draw_game(FULL_DRAW);
-                return FULL_DRAW;
-            }
-        case SLIME:                                                             // if item is SLIME, tile is erased and slime count is incremented
-            if((Player.slimeCount <= 5) || Player.omni_mode) {
-                if(direction == 1) map_erase(x, y-1);
-                else if(direction == 2) map_erase(x, y+1);
-                else if(direction == 3) map_erase(x+1, y);
-                else if(direction == 4) map_erase(x-1, y);
-                draw_game(FULL_DRAW);
-                Player.slimeCount++;
-                if(Player.slimeCount <= 5) {
-                    draw_slimeCount(Player.slimeCount);
-                }
-                return FULL_DRAW;
-            }
-        case PORTAL:                                                            // if item is PORTAL, player is locked in map 0 until quest given, and
-            switch(Player.map) {                                                // locked in map 1 until quest is completed
-                case 0:
-                    if(Player.NPCprogress == 1 || Player.omni_mode) {           // or if omni_mode enabled
-                        Player.map = 1;
-                        set_active_map(Player.map);
-                        Player.x = 15;
-                        Player.y = 22;
-                        draw_slimeCount(Player.slimeCount);                     // slime counter appears on top of screen
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    } else if(Player.NPCprogress == 0) {
-                        line1 = "Talk to The Eye";
-                        line2 = "north of here";
-                        speech(line1, line2);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    } else {
-                        line1 = "Head East to ";
-                        line2 = "the gate";
-                        speech(line1, line2);
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    }
-                case 1:
-                    if(((Player.slimeCount == 5) && Player.NPCprogress == 2) || Player.omni_mode) {
-                        Player.map = 0;
-                        set_active_map(Player.map);
-                        Player.x = 5;
-                        Player.y = 43;
-                        add_NPC(31, 43);
-                        map_erase(6,5);
-                        clear_slimeCount();                                     // slime counter cleared from top of screen
-                        draw_game(FULL_DRAW);
-                        return FULL_DRAW;
-                    } else {
-                        if(Player.slimeCount < 5) {
-                            line1 = "Capture 5 slimes!";
-                            line2 = "";
-                            speech(line1, line2);
-                            draw_game(FULL_DRAW);
-                            return FULL_DRAW;
-                        } else {
-                            line1 = "Talk to The Eye";
-                            line2 = "";
-                            speech(line1, line2);
-                            draw_game(FULL_DRAW);
-                            return FULL_DRAW;
-                        }
-                    }
-            }
-        default :
-            return NO_RESULT;
-    }
+    if(Player.slimeCount <= 5) draw_slimeCount(Player.slimeCount);
 }
 
-void npcAction()                                                                // function for determining what dialogue NPC will say
+static void hud_lives()
 {
-    char *line1;
-    char *line2;
-    switch(Player.NPCprogress) {
-        case 0:                                                                 // player given quest 1
-            line1 = "The Eye: Ah, a";
-            line2 = "Traveller! I";
-            speech(line1,line2);
-            line1 = "have a small";
-            line2 = "problem I could";
-            speech(line1,line2);
-            line1 = "use your help";
-            line2 = "with. Capture";
-            speech(line1,line2);
-            line1 = "5 slimes from my";
-            line2 = "dungeon. You can";
-            speech(line1,line2);
-            line1 = "get there by";
-            line2 = "taking the portal";
-            speech(line1,line2);
-            line1 = "south of here";
-            line2 = "Good Luck!";
-            speech(line1,line2);
-            Player.NPCprogress = 1;
-            break;
+    draw_lifeCount(Player.lives);
+}
 
-        case 1:
-            if(Player.slimeCount == 5 || Player.omni_mode) {                    // player told to move to quest 2 zone
-                line1 = "Excellent work!";
-                line2 = "You are now";
-                speech(line1, line2);
-                line1 = "strong enough to";
-                line2 = "move rocks! Also,";
-                speech(line1, line2);
-                line1 = "could I ask for";
-                line2 = "another favor?";
-                speech(line1,line2);
-                line1 = "Go through the";
-                line2 = "portal and head";
-                speech(line1, line2);
-                line1 = "East. Move the";
-                line2 = "rock and open";
-                speech(line1,line2);
-                line1 = "up the gate";
-                line2 = "on the river.";
-                speech(line1,line2);
-                line1 = "You could also";
-                line2 = "head towards ";
-                speech(line1, line2);
-                line1 = "the NorthEast";
-                line2 = "corner for a ";
-                speech(line1, line2);
-                line1 = "treasure I ";
-                line2 = "uncovered...";
-                speech(line1, line2);
-                line1 = "I'll see you";
-                line2 = "at the gate!";
-                speech(line1, line2);
-                Player.NPCprogress = 2;
-                map_erase(13, 21);
-                Player.has_key = 1;
-                break;
-            } else if (Player.slimeCount < 5) {
-                line1 = "What are you";
-                line2 = "waiting for? Go";
-                speech(line1,line2);
-                line1 = "get those slimes";
-                line2 = "Traveller!";
-                speech(line1,line2);
-                break;
-            }
-        case 2:
-            if(Player.has_key == 2 || Player.omni_mode) {
-                Player.has_key = 2;
-                line1 = "Impressive! I";
-                line2 = "knew that I could";
-                speech(line1,line2);
-                line1 = "trust you to get";
-                line2 = "my keys! Come ";
-                speech(line1,line2);
-                line1 = "inside for ";
-                line2 = "your reward!";
-                speech(line1,line2);
-                map_erase(31, 43);
-                add_NPC(45, 43);
-                Player.NPCprogress = 3;
-                break;
-            } else if (Player.has_key == 1) {                                   // player given quest 2
-                Player.has_key = 1;
-                line1 = "I dropped my keys";
-                line2 = "and now I can't";
-                speech(line1,line2);
-                line1 = "get inside my ";
-                line2 = "house... Could";
-                speech(line1,line2);
-                line1 = "you get them for";
-                line2 = "me? They are";
-                speech(line1,line2);
-                line1 = "outside the north";
-                line2 = "part of my house.";
-                speech(line1,line2);
-                line1 = "Watch out for the";
-                line2 = "ghosts,they hurt!";
-                speech(line1,line2);
-                draw_lifeCount(Player.lives);
-                if(Player.omni_mode) Player.has_key = 2;
-                break;
-            } else
-                break;
-        case 3:
-            return game_over();                                                 // game won
-        default:
-            break;
+static void hud_health()
+{
+    draw_lower_status(Player.health, Player.has_heart);
+}
+
+void init_quest()                                                               // bind the quest script to the game and load it
+{
+    script_bind(SV_PROGRESS, &Player.NPCprogress);
+    script_bind(SV_KEY, &Player.has_key);
+    script_bind(SV_SLIMES, &Player.slimeCount);
+    script_bind(SV_OMNI, &Player.omni_mode);
+    script_bind(SV_MAP, &Player.map);
+    script_bind(SV_HEART, &Player.has_heart);
+    script_bind(SV_LIVES, &Player.lives);
+    script_bind(SV_HEALTH, &Player.health);
+    script_bind(SV_X, &Player.x);
+    script_bind(SV_Y, &Player.y);
+    script_hook(SH_SLIMES, hud_slimes);
+    script_hook(SH_NOSLIMES, clear_slimeCount);
+    script_hook(SH_LIVES, hud_lives);
+    script_hook(SH_HEALTH, hud_health);
+    script_hook(SH_WIN, game_over);
+
+    int err = script_load_text(quest);
+    if(err) pc.printf("built-in quest: error on line %d\r\n", err);
+
+    quest_buf = (char*) malloc(QUEST_MAX + 1);                                  // start reading the SD card's quest behind the start screen
+    if(quest_buf && io_submit_read(&quest_req, QUEST_FILE, 0, quest_buf, QUEST_MAX)) {
+        free(quest_buf);
+        quest_buf = NULL;
     }
 }
 
+void finish_quest()                                                             // wait for the SD card's quest and replace the built-in one with it
+{
+    if(!quest_buf) return;
+    while(quest_req.status == IO_PENDING) io_poll(100);
+    if(quest_req.status == IO_DONE && quest_req.count == QUEST_MAX) {           // filled the buffer, so the file may go on
+        pc.printf("quest.txt: %d bytes or longer\r\n", QUEST_MAX);
+    } else if(quest_req.status == IO_DONE && quest_req.count > 0) {
+        quest_buf[quest_req.count] = 0;
+        int err = script_load_text(quest_buf);
+        if(err) {
+            pc.printf("quest.txt: error on line %d\r\n", err);
+            script_load_text(quest);                                            // fall back to the built-in quest
+        }
+    }
+    free(quest_buf);
+    quest_buf = NULL;
+}
+
+int do_action(MapItem *item, int direction, int x, int y)                       // function for determining what action button does depending on adjacent tile
+{
+    if(!item) return NO_RESULT;                                                 // empty tile, nothing to do
+    if(direction == 1) y--;                                                     // the tile acted on
+    else if(direction == 2) y++;
+    else if(direction == 3) x++;
+    else if(direction == 4) x--;
+    if(!script_run(item->type, x, y)) return NO_RESULT;                         // no rule for this item, or it did nothing
+    draw_game(FULL_DRAW);
+    return FULL_DRAW;
+}
+
 int go_right(int x, int y)
 {
-    MapItem *item = get_east(x, y);                                             // get item to right
-    if ( (item->walkable) || Player.omni_mode) return 1;                        // check if walkable
+    if (map_walkable(x+1, y) || (Player.omni_mode && x+1 < map_width())) return 1; // check if walkable; omni mode walks through walls but not off the map
     else return 0;
 }
 
 int go_left(int x, int y)
 {
-    MapItem *item = get_west(x, y);                                             // get item to left
-    if ( (item->walkable) || Player.omni_mode) return 1;                        // check if walkable
+    if (map_walkable(x-1, y) || (Player.omni_mode && x > 0)) return 1;          // check if walkable; omni mode walks through walls but not off the map
     else return 0;
 }
 
 int go_up(int x, int y)
 {
-    MapItem *item = get_north(x, y);                                            // get item to north
-    if ((item->walkable) || Player.omni_mode) return 1;                         // check if walkable
+    if (map_walkable(x, y-1) || (Player.omni_mode && y > 0)) return 1;          // check if walkable; omni mode walks through walls but not off the map
     else return 0;
 }
 
 int go_down(int x, int y)
 {
-    MapItem *item = get_south(x, y);                                            //get item to south
-    if ((item->walkable) || Player.omni_mode) return 1;                         // check if walkable
+    if (map_walkable(x, y+1) || (Player.omni_mode && y+1 < map_height())) return 1; // check if walkable; omni mode walks through walls but not off the map
     else return 0;
 }
 
@@ -542,6 +409,7 @@ int go_down(int x, int y)
  */
 void draw_game(int init)
 {
+    if(sim_headless()) return;                                                  // nothing to draw in a headless run
     // Draw game border first
     if(init) draw_border();
 
@@ -568,16 +436,19 @@ void draw_game(int init)
             if (x >= 0 && y >= 0 && x < map_width() && y < map_height()) { // Current (i,j) in the map
                 MapItem* curr_item = get_here(x, y);
                 MapItem* prev_item = get_here(px, py);
-                if (init || curr_item != prev_item) { // Only draw if they're different
-                    if (curr_item) { // There's something here! Draw it
+                DrawFunc curr_ent = entity_draw_at(x, y);                       // entities are drawn over their tile
+                DrawFunc prev_ent = entity_draw_at(px, py);
+                if (init || curr_item != prev_item || curr_ent != prev_ent) { // Only draw if they're different
+                    if (curr_ent) {
+                        draw = curr_ent;
+                    } else if (curr_item) { // There's something here! Draw it
                         draw = curr_item->draw;
                     } else { // There used to be something, but now there isn't
                         draw = draw_nothing;
                     }
                 }
             } else if (init) { // If doing a full draw, but we're out of bounds, draw the walls.
-                if(Player.map == 0) draw = draw_wall1;
-                if(Player.map == 1) draw = draw_wall2;
+                draw = map_border();
             }
 
             // Actually draw the tile
@@ -585,157 +456,167 @@ void draw_game(int init)
         }
     }
 
+    // Entities that moved this tick: repaint where they were and where they are
+    EntityList* ents = get_entities();
+    for (int e = 0; e < ents->count; e++) {
+        if (ents->map[e] != get_active_map()) continue;
+        if (ents->x[e] == ents->px[e] && ents->y[e] == ents->py[e]) continue;
+        draw_cell(ents->px[e] - Player.px, ents->py[e] - Player.py);
+        draw_cell(ents->x[e] - Player.x, ents->y[e] - Player.y);
+    }
+
     draw_player(Player.x, Player.y, Player.has_key);
 
     // Draw status bars
-    if((Player.x!=Player.px) || (Player.py != Player.y)) {                      // only update coordinates if player moved
-        draw_upper_status(Player.x, Player.y);
-    }
-    if((Player.health != Player.phealth) || (Player.lives != Player.plives)) {  // only update health bar if health or lives changed
-        draw_lower_status(Player.health, Player.has_heart);
+    draw_upper_status(Player.x, Player.y);                                      // only what changed since the last frame is sent
+    draw_lower_status(Player.health, Player.has_heart);
+}
+
+/**
+ * Redraw the tile at screen offset (i,j) from the player, entity included.
+ * Offsets outside the visible window and the player's own tile are ignored.
+ */
+void draw_cell(int i, int j)
+{
+    if (i < -5 || i > 5 || j < -4 || j > 4 || (i == 0 && j == 0)) return;
+    int x = i + Player.x;
+    int y = j + Player.y;
+    DrawFunc draw = draw_nothing;
+    if (x < 0 || y < 0 || x >= map_width() || y >= map_height()) {
+        draw = map_border();
+    } else if (entity_draw_at(x, y)) {
+        draw = entity_draw_at(x, y);
+    } else if (get_here(x, y)) {
+        draw = get_here(x, y)->draw;
     }
+    draw((i+5)*11 + 3, (j+4)*11 + 15);
 }
 
 
 /**
- * Initialize the main world map. Add walls around the edges, interior chambers,
- * and plants in the background so you can see motion.
+ * The layout of the main map, built into flash. The layouts are plain const
+ * aggregates of MapRun rather than constexpr or template output: this code is
+ * C++03, and a const array with constant initializers lands in flash all the
+ * same.
  */
-void init_main_map()
-{
+static const MapRun main_layout[] = {
     // "Random" plants
-    add_plant(5,  4);
-    add_plant(19, 8);
-    add_plant(26, 10);
-    add_plant(33, 12);
-    add_plant(47,16);
-    add_plant(13,20);
-    add_plant(20, 22);
-    add_plant(27, 24);
-    add_plant(41, 28);
-    add_plant(7, 32);
-    add_plant(14, 34);
-    add_plant(21, 36);
-    add_plant(35, 40);
-    add_plant(8, 44);
-    pc.printf("plants\r\n");
-
-    add_rock(45,3);
-    add_rock(46,4);
-    add_rock(46,2);
-    add_rock(47,3);
-    pc.printf("rock\r\n");
-
-    add_heart(46,3);
-    pc.printf("powerup\r\n");
-
-    add_NPC(6,5);
-    pc.printf("NPC\r\n");
-
-    add_portal(5,45);
-    pc.printf("portal\r\n");
-
-    add_ghost(38,34);
-    add_ghost(38,35);
-    add_ghost(38,36);
-    add_ghost(38,37);
-
-    add_ghost(40,34);
-    add_ghost(40,36);
-    add_ghost(40,37);
-    add_ghost(40,38);
-
-    add_ghost(42,34);
-    add_ghost(42,35);
-    add_ghost(42,36);
-    add_ghost(42,38);
-
-    add_ghost(44,35);
-    add_ghost(44,36);
-    add_ghost(44,37);
-    add_ghost(44,38);
-
-    add_ghost(46,34);
-    add_ghost(46,35);
-    add_ghost(46,36);
-    add_ghost(46,37);
-    pc.printf("ghosts\r\n");
-
-    add_key(48, 36);
-    pc.printf("key\r\n");
-
-    add_river(30,             33,            HORIZONTAL, 19);
-    add_river(29,             33,            VERTICAL,   7);
-    add_river(29,             41,            VERTICAL,   8);
-    pc.printf("River done!\r\n");
-
-    add_rock(28,40);
-    pc.printf("rock\r\n");
-
-    add_gate1(29,40);
-    pc.printf("gate1\r\n");
-
-    add_gate2(35,40);
-    add_gate2(35,41);
-    pc.printf("gates2\r\n");
-
-    add_wall2(35,             42,             VERTICAL, 7);
-    add_wall2(35,             39,             HORIZONTAL, 15);
-    pc.printf("wall2 done!\r\n");
-
-    pc.printf("Adding walls!\r\n");
-    add_wall1(0,              0,              HORIZONTAL, map_width());
-    add_wall1(0,              map_height()-1, HORIZONTAL, map_width());
-    add_wall1(0,              0,              VERTICAL,   map_height());
-    add_wall1(map_width()-1,  0,              VERTICAL,   map_height());
-    pc.printf("Walls done!\r\n");
+    MAP_AT(PLANT, 5, 4),
+    MAP_AT(PLANT, 19, 8),
+    MAP_AT(PLANT, 26, 10),
+    MAP_AT(PLANT, 33, 12),
+    MAP_AT(PLANT, 47, 16),
+    MAP_AT(PLANT, 13, 20),
+    MAP_AT(PLANT, 20, 22),
+    MAP_AT(PLANT, 27, 24),
+    MAP_AT(PLANT, 41, 28),
+    MAP_AT(PLANT, 7, 32),
+    MAP_AT(PLANT, 14, 34),
+    MAP_AT(PLANT, 21, 36),
+    MAP_AT(PLANT, 35, 40),
+    MAP_AT(PLANT, 8, 44),
+
+    MAP_AT(ROCK, 45, 3),
+    MAP_AT(ROCK, 46, 4),
+    MAP_AT(ROCK, 46, 2),
+    MAP_AT(ROCK, 47, 3),
+    MAP_AT(HEART, 46, 3),                                                       // powerup
+    MAP_AT(NPC, 6, 5),
+    MAP_AT(PORTAL, 5, 45),
+
+    MAP_AT(GHOST, 38, 34),
+    MAP_AT(GHOST, 38, 35),
+    MAP_AT(GHOST, 38, 36),
+    MAP_AT(GHOST, 38, 37),
+
+    MAP_AT(GHOST, 40, 34),
+    MAP_AT(GHOST, 40, 36),
+    MAP_AT(GHOST, 40, 37),
+    MAP_AT(GHOST, 40, 38),
+
+    MAP_AT(GHOST, 42, 34),
+    MAP_AT(GHOST, 42, 35),
+    MAP_AT(GHOST, 42, 36),
+    MAP_AT(GHOST, 42, 38),
+
+    MAP_AT(GHOST, 44, 35),
+    MAP_AT(GHOST, 44, 36),
+    MAP_AT(GHOST, 44, 37),
+    MAP_AT(GHOST, 44, 38),
+
+    MAP_AT(GHOST, 46, 34),
+    MAP_AT(GHOST, 46, 35),
+    MAP_AT(GHOST, 46, 36),
+    MAP_AT(GHOST, 46, 37),
+
+    MAP_AT(KEY, 48, 36),
+
+    MAP_RUN(RIVER, 30, 33, HORIZONTAL, 19),
+    MAP_RUN(RIVER, 29, 33, VERTICAL, 7),
+    MAP_RUN(RIVER, 29, 41, VERTICAL, 8),
+
+    MAP_AT(ROCK, 28, 40),
+    MAP_AT(GATE1, 29, 40),
+    MAP_AT(GATE2, 35, 40),
+    MAP_AT(GATE2, 35, 41),
+
+    MAP_RUN(DUNGEONBRICK, 35, 42, VERTICAL, 7),
+    MAP_RUN(DUNGEONBRICK, 35, 39, HORIZONTAL, 15),
+
+    // Walls
+    MAP_RUN(TREE, 0, 0, HORIZONTAL, WIDTH1),
+    MAP_RUN(TREE, 0, HEIGHT1-1, HORIZONTAL, WIDTH1),
+    MAP_RUN(TREE, 0, 0, VERTICAL, HEIGHT1),
+    MAP_RUN(TREE, WIDTH1-1, 0, VERTICAL, HEIGHT1),
+};
 
-    print_map();
-}
+/**
+ * The layout of the dungeon maze.
+ */
+static const MapRun sub_layout[] = {
+    MAP_RUN(DUNGEONBRICK, 1, 19, HORIZONTAL, 15),
+    MAP_RUN(DUNGEONBRICK, 5, 14, HORIZONTAL, 11),
+    MAP_RUN(DUNGEONBRICK, 1, 5, HORIZONTAL, 10),
+    MAP_RUN(DUNGEONBRICK, 20, 14, HORIZONTAL, 5),
+    MAP_RUN(DUNGEONBRICK, 1, 9, HORIZONTAL, 5),
+    MAP_RUN(DUNGEONBRICK, 10, 9, HORIZONTAL, 6),
+    MAP_RUN(DUNGEONBRICK, 15, 4, HORIZONTAL, 6),
+    MAP_RUN(DUNGEONBRICK, 20, 20, VERTICAL, 4),
+    MAP_RUN(DUNGEONBRICK, 20, 10, VERTICAL, 4),
+    MAP_RUN(DUNGEONBRICK, 5, 10, VERTICAL, 4),
+    MAP_RUN(DUNGEONBRICK, 10, 6, VERTICAL, 3),
+    MAP_RUN(DUNGEONBRICK, 15, 1, VERTICAL, 3),
+
+    MAP_AT(PORTAL, 16, 21),
+    MAP_AT(NPC, 13, 21),
+
+    MAP_AT(SLIME, 2, 2),
+    MAP_AT(SLIME, 17, 2),
+    MAP_AT(SLIME, 2, 12),
+    MAP_AT(SLIME, 22, 12),
+    MAP_AT(SLIME, 22, 21),
+
+    // Walls
+    MAP_RUN(DUNGEONBRICK, 0, 0, HORIZONTAL, WIDTH2),
+    MAP_RUN(DUNGEONBRICK, 0, HEIGHT2-1, HORIZONTAL, WIDTH2),
+    MAP_RUN(DUNGEONBRICK, 0, 0, VERTICAL, HEIGHT2),
+    MAP_RUN(DUNGEONBRICK, WIDTH2-1, 0, VERTICAL, HEIGHT2),
+};
 
-void init_sub_map()
+/**
+ * Define the maps: the main world map, with walls around the edges, interior
+ * chambers, and plants in the background so you can see motion, and the
+ * dungeon. Neither is built until it is entered: the main map at the start of
+ * the game, and the dungeon when the player first takes the portal. The
+ * dungeon is freed again whenever they leave it.
+ */
+void init_maps()
 {
-    Map* map = set_active_map(1);
-
-    add_wall2(1, 19, HORIZONTAL, 15);
-    add_wall2(5, 14, HORIZONTAL, 11);
-    add_wall2(1, 5, HORIZONTAL, 10);
-    add_wall2(20, 14, HORIZONTAL, 5);
-    add_wall2(1, 9, HORIZONTAL, 5);
-    add_wall2(10, 9, HORIZONTAL, 6);
-    add_wall2(15, 4, HORIZONTAL, 6);
-    add_wall2(20, 20, VERTICAL, 4);
-    add_wall2(20, 10, VERTICAL, 4);
-    add_wall2(5, 10, VERTICAL, 4);
-    add_wall2(10, 6, VERTICAL, 3);
-    add_wall2(15, 1, VERTICAL, 3);
-    pc.printf("maze built\r\n");
-
-    add_portal(16,21);
-    pc.printf("portal\r\n");
-
-    add_NPC(13,21);
-    pc.printf("NPC\r\n");
-
-    add_slime(2,2);
-    add_slime(17,2);
-    add_slime(2,12);
-    add_slime(22,12);
-    add_slime(22,21);
-    pc.printf("slimes\r\n");
-
-    pc.printf("Adding walls!\r\n");
-    add_wall2(0,              0,              HORIZONTAL, map_width());
-    pc.printf("top!\r\n");
-    add_wall2(0,              map_height()-1, HORIZONTAL, map_width());
-    pc.printf("bottom\r\n");
-    add_wall2(0,              0,              VERTICAL,   map_height());
-    pc.printf("left\r\n");
-    add_wall2(map_width()-1,  0,              VERTICAL,   map_height());
-    pc.printf("right\r\n");
-
-    print_map();
+    maps_init();
+    map_define(0, WIDTH1, HEIGHT1, TREE, main_layout, sizeof(main_layout) / sizeof(main_layout[0]), 0);
+    map_define(1, WIDTH2, HEIGHT2, DUNGEONBRICK, sub_layout, sizeof(sub_layout) / sizeof(sub_layout[0]), MAP_EVICT);
 }
+
 /**
  * Program entry point! This is where it all begins.
  * This function orchestrates all the parts of the game. Most of your
@@ -746,37 +627,88 @@ int main()
 {
     // First things first: initialize hardware
     ASSERT_P(hardware_init() == ERROR_NONE, "Hardware init failed!");
+    io_init(&sd);                                                               // queued reads from the SD card
 
     // Initialize the maps
-    maps_init();
-    init_main_map();
-    init_sub_map();
+    init_maps();
+#ifdef MAP_IMAGE
+    // Build with -DMAP_IMAGE='"/sd/maps.img"' to start the maps from an image
+    // of their changes and entities, which is saved as the maps start out if
+    // it isn't there yet
+    if(map_load(MAP_IMAGE)) {
+        if(map_save(MAP_IMAGE)) pc.printf("map image: can't save %s\r\n", MAP_IMAGE);
+    }
+#endif
+    ASSERT_P(set_active_map(0) != NULL, ERROR_MEH);                             // no memory to build the main map
+    print_map();
+    init_quest();
+
+#ifdef PATH_BENCH
+    // Build with -DPATH_BENCH=n to time n path searches on each map
+    set_active_map(0);
+    path_bench(PATH_BENCH);
+    set_active_map(1);
+    path_bench(PATH_BENCH);
+#endif
+
+#if defined(REPLAY_FROM)
+    // Build with -DREPLAY_FROM='"/sd/run.gir"' to play back a recording, and
+    // -DREPLAY_FAST to skip the frame delay
+#ifndef REPLAY_FAST
+#define REPLAY_FAST 0
+#endif
+    if(replay_play(REPLAY_FROM, REPLAY_FAST)) pc.printf("replay: can't open %s\r\n", REPLAY_FROM);
+#ifdef HEADLESS
+    // Add -DHEADLESS to also skip all drawing
+    else sim_start(1);
+#endif
+#elif defined(FUZZ)
+    // Build with -DFUZZ=seed to play FUZZ_FRAMES frames of random inputs
+    // headless, checking invariants every frame. This is the game itself on
+    // the board: one seed per run, on one core. It checks game state only;
+    // there is no host build to run leak or address checkers on
+#ifndef FUZZ_FRAMES
+#define FUZZ_FRAMES 100000
+#endif
+    replay_fuzz(FUZZ, FUZZ_FRAMES);
+    sim_start(1);
+#elif defined(REPLAY_TO)
+    // Build with -DREPLAY_TO='"/sd/run.gir"' to record this play-through
+    if(replay_record(REPLAY_TO)) pc.printf("replay: can't create %s\r\n", REPLAY_TO);
+#endif
 
     // Initialize game state
     set_active_map(0);
     Player.x = Player.y = 3;                                                    // Start player at (3,3)
 
-    draw_start();                                                               // show start screen until B2 is held
-    uLCD.filled_rectangle(0,8,127,0,BLACK);                                     // clear top bar from start screen
+    if(replay_mode() < REPLAY_PLAY) {                                           // show start screen until B2 is held, unless inputs are canned
+        draw_start();
+        uLCD.filled_rectangle(0,8,127,0,BLACK);                                 // clear top bar from start screen
+        uLCD.filled_rectangle(0,118,128,128,BLACK);                             // clear bottom area from start screen
+    }
+    finish_quest();
 
     Player.health = 100;                                                        // initialize player health at 100
     Player.lives  = 3;                                                          // initialize player lives at 3
 
-    uLCD.filled_rectangle(0,118,128,128,BLACK);                                 // clear bottom area from start screen
-
     // Initial drawing
     draw_game(true);
-    draw_player(Player.x, Player.y, Player.has_key);
+    if(!sim_headless()) draw_player(Player.x, Player.y, Player.has_key);        // nothing to draw in a headless run
 
     // Main game loop
-    while(1) {
+    sim_start(sim_headless());                                                  // count frames from here
+    while(!sim_stopped()) {
         // Timer to measure game update speed
         Timer t;
         t.start();
 
         // Actuall do the game update:
         // 1. Read inputs
-        in = read_inputs();
+        in = replay_inputs();                                                   // live, recorded or played back
+        if(replay_finished()) {
+            sim_stop("end of replay");
+            break;
+        }
         // 2. Determine action (get_action)
         int action = get_action(in);
         // 3. Update game (update_game)
@@ -784,14 +716,15 @@ int main()
         Player.plives   = Player.lives;
 
         int update = update_game(action);
+        entity_update(Player.x, Player.y);                                      // move ghosts and other actors
 
         char* line1;
         char* line2;
-        if(((get_here(Player.x,Player.y))->type == GHOST) && !Player.omni_mode) {
+        if((entity_at(Player.x, Player.y, GHOST) != -1) && !Player.omni_mode) {
             if(Player.has_heart == 0) Player.health = Player.health-20;         // player loses 20 health for standing in ghost every 100ms
             else if(Player.has_heart == 1) Player.health = Player.health-10;    // player loses 10 health for standing in ghost with powerup active
             if(Player.health == 0) {
-                uLCD.filled_rectangle(70,122,120,128,RED);                      // show red health bar once dead
+                draw_lower_status(0, Player.has_heart);                         // show red health bar once dead
                 Player.lives--;
                 switch(Player.lives) {                                          // messages showing less lives
                     case 2:
@@ -825,7 +758,8 @@ int main()
             }
         }
         // 3b. Check for game over
-        if(update == GAME_LOST) {                                               // show game lost screen
+        if(update == GAME_LOST && sim_headless()) sim_stop("game lost");        // no screen or music in a headless run
+        else if(update == GAME_LOST) {                                          // show game lost screen
             uLCD.filled_rectangle(0,0,128,128,BLACK);
             uLCD.locate(1,3);
             uLCD.color(RED);
@@ -862,16 +796,62 @@ int main()
         if(update == GAME_OVER)  game_over();                                   // show game won screen
         // 4. Draw frame (draw_game)
         draw_game(update);                                                      // update game
+        sim_frame();
+#ifdef MAP_STATS
+        // Build with -DMAP_STATS=n to dump the map HashTable statistics every n frames
+        static long stats_frames;
+        if(++stats_frames % (MAP_STATS) == 0) map_stats();
+#endif
+#ifdef FUZZ
+        if(game_check(replay_frames())) {
+            pc.printf("fuzz: seed %u, frame %d\r\n", (unsigned)(FUZZ), replay_frames());
+            sim_stop("invariant failed");
+        }
+#endif
 
         // 5. Frame delay
+        int fast = replay_fast() || sim_headless();
+        io_poll(fast ? 0 : 100 - t.read_ms());                                  // queued SD reads get the rest of the frame, at least one chunk
+        if(fast) continue;                                                      // fast replay: no delay
         t.stop();
         int dt = t.read_ms();
         if (dt < 100) wait_ms(100 - dt);
     }
+    sim_report();                                                               // the replay ran out, or a headless game ended
+    replay_stop();
+    return 0;
+}
+
+/**
+ * Check the game state for things that should never happen, and every
+ * CHECK_PERIOD frames the map and entity structures as well. Prints the first
+ * problem found and returns -1, or returns 0.
+ */
+#define CHECK_PERIOD 64
+int game_check(long frame)
+{
+    const char* err = NULL;
+    if(get_active_map() != get_map(Player.map)) err = "wrong active map";
+    else if(Player.x < 0 || Player.y < 0 || Player.x >= map_width() || Player.y >= map_height()) err = "player off the map";
+    else if(!Player.omni_mode && (Player.x != Player.px || Player.y != Player.py) &&
+            !map_walkable(Player.x, Player.y)) err = "player moved into a wall";    // omni mode may leave the player in one
+    else if(Player.health <= 0 || Player.health > 100) err = "bad health";
+    else if(Player.lives < 0 || Player.lives > 3) err = "bad lives";
+    else if(Player.has_key < 0 || Player.has_key > 2 || Player.NPCprogress < 0 || Player.NPCprogress > 3) err = "bad quest state";
+    if(err) {
+        pc.printf("game_check: frame %ld, player (%d,%d) on map %d: %s\r\n", frame, Player.x, Player.y, Player.map, err);
+        return -1;
+    }
+    if(frame % CHECK_PERIOD) return 0;
+    return (map_check() || entity_check()) ? -1 : 0;
 }
 
 void game_over()
 {
+    if(sim_headless()) {
+        sim_stop("game won");
+        return;
+    }
     uLCD.filled_rectangle(0,0,128,128,BLACK);
     uLCD.locate(1,3);
     uLCD.color(TEXTGREEN);
@@ -969,5 +949,6 @@ void draw_start()
         uLCD.color(TEXTGREEN);
         uLCD.printf(name);
         in = read_inputs();
+        io_poll(10);                                                            // read the quest while the title is up
     }
 }
\ No newline at end of file
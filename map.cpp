@@ -2,23 +2,104 @@
 
 #include "globals.h"
 #include "graphics.h"
+#include "entity.h"
+#include "hash_map.h"
+
+#include <new>
+#include <string.h>
 
 /**
- * The Map structure. This holds a HashTable for all the MapItems, along with
- * values for the width and height of the Map.
+ * MapItems are stored in the table by value, so a lookup is one hash and a
+ * walk down the chain, with no function pointer call or extra pointer hop.
+ */
+typedef HashMap<unsigned, MapItem, MapHash> MapTable;
+
+/**
+ * The Map structure. This holds the map's static layout, a MapTable for all
+ * the other MapItems, and values for the width and height of the Map.
  */
 struct Map {
-    HashTable* items;
+    /**
+     * The layout the map was built from, read in place. Its tiles are not in
+     * the table: the bitmaps say which are still there, and they all share
+     * the prototype MapItem of their type.
+     */
+    const MapRun* layout;
+    int layout_len;
+    /**
+     * The overlay: MapItems added at run time, and layout tiles that were
+     * replaced.
+     */
+    MapTable* items;
     int w, h;
+    /**
+     * Spatial grid: one mask per MAP_CELL x MAP_CELL block of tiles, with bit t
+     * set if the block holds a MapItem of type t. Queries only look inside
+     * blocks whose mask matches.
+     */
+    unsigned short* cells;
+    int cw, ch;
+    /**
+     * Occupancy bitmaps, 1 bit per tile in row-major order, stride bytes each:
+     * one per MapItem type, then one more (BLOCKED) with a bit set for every
+     * tile holding a MapItem that is not walkable. Kept in step with the
+     * layout and table by place() and map_erase().
+     */
+    unsigned char* bits;
+    int stride;
+    /**
+     * Residency. The table, grid and bitmaps are only allocated while the map
+     * is resident. built is set once the map has first been built, and its
+     * actors added as entities; while it is evicted, saved holds its saved_len changes
+     * from the layout, in image item form.
+     */
+    int flags;
+    int resident, built;
+    unsigned char* saved;
+    int saved_len;
+    int border;                         // type drawn beyond the edges
+    int index;                          // in the registry
 };
 
+// Index of the not-walkable bitmap in Map.bits
+#define BLOCKED MAP_TYPES
+
 /**
- * Storage area for the maps.
+ * The map registry: map_define adds maps to it, and grows it as needed. Each
+ * Map is allocated on its own and never freed, so a Map* (held by an entity,
+ * say) stays valid as the registry grows and is cleared. Slots between
+ * defined maps hold empty Maps (w == 0).
  * This is a global variable, but can only be access from this file because it
  * is static.
  */
-static Map map[2];                                                              // make array of map structs for 2 maps
+static Map** maps;
+static int num_maps;                                                            // maps[0..num_maps-1] are in use
+static int max_maps;                                                            // and this many are allocated
 static int active_map;
+static unsigned version;                                                        // bumped on every add or erase
+
+/**
+ * The MapItem for each type as the add_* functions make it. Every layout tile
+ * of a type is this one item; the drawing functions also rebuild items read
+ * from an image.
+ */
+static MapItem proto[MAP_TYPES] = {
+    {TREE,          draw_wall1,     false,  0},
+    {DUNGEONBRICK,  draw_wall2,     false,  0},
+    {PLANT,         draw_plant,     true,   0},
+    {RIVER,         draw_river,     false,  0},
+    {4,             NULL,           false,  0},                                 // unused
+    {PORTAL,        draw_portal,    false,  0},
+    {NPC,           draw_NPC,       false,  0},                                 // an entity, as are SLIME and ROCK
+    {SLIME,         draw_slime,     false,  0},
+    {GHOST,         draw_ghost,     true,   0},                                 // an entity the player can walk into
+    {GATE1,         draw_gate1,     false,  0},
+    {GATE2,         draw_gate2,     false,  0},
+    {FLAG,          draw_flag,      true,   0},
+    {KEY,           draw_key,       false,  0},
+    {ROCK,          draw_rock,      false,  0},
+    {HEART,         draw_heart,     false,  0},
+};
 
 /**
  * The first step in HashTable access for the map is turning the two-dimensional
@@ -26,56 +107,686 @@ static int active_map;
  * This function should uniquely map (x,y) onto the space of unsigned integers.
  */
 static unsigned XY_KEY(int X, int Y) {
-    return X*(map[active_map].h)+Y;                                             // simple key algorithm for current tile using height of current map
+    return X*(maps[active_map]->h)+Y;                                         // simple key algorithm for current tile using height of current map
 }
 
 /**
- * This is the hash function actually passed into createHashTable. It takes an
- * unsigned key (the output of XY_KEY) and turns it into a hash value (some
- * small non-negative integer).
+ * Bit access for the occupancy bitmaps of map m. b is a type or BLOCKED.
  */
-unsigned map_hash(unsigned key)
+static int get_bit(Map* m, int b, int x, int y)
 {
-    return key%(NUMBUCKETS);
+    int i = y * m->w + x;
+    return (m->bits[b * m->stride + (i >> 3)] >> (i & 7)) & 1;
 }
 
-void maps_init()
+static void set_bit(Map* m, int b, int x, int y, int on)
+{
+    int i = y * m->w + x;
+    unsigned char* p = &m->bits[b * m->stride + (i >> 3)];
+    if (on) *p |= 1 << (i & 7);
+    else *p &= ~(1 << (i & 7));
+}
+
+/**
+ * Type of the MapItem at (x,y), found from the bitmaps of the types in mask,
+ * or -1 if none of them is there.
+ */
+static int type_at(Map* m, int x, int y, unsigned short mask)
+{
+    for (int t = 0; mask; t++, mask >>= 1) {
+        if ((mask & 1) && get_bit(m, t, x, y)) return t;
+    }
+    return -1;
+}
+
+/**
+ * Clear (x,y) from the bitmaps after the given item has left it, and drop its
+ * type from the grid cell mask if it was the last one of that type there.
+ */
+static void unmark(Map* m, int x, int y, MapItem* item)
+{
+    set_bit(m, item->type, x, y, 0);
+    set_bit(m, BLOCKED, x, y, 0);
+    int cx = x / MAP_CELL, cy = y / MAP_CELL;
+    for (int ty = cy*MAP_CELL; ty < (cy+1)*MAP_CELL && ty < m->h; ty++) {
+        for (int tx = cx*MAP_CELL; tx < (cx+1)*MAP_CELL && tx < m->w; tx++) {
+            if (get_bit(m, item->type, tx, ty)) return;
+        }
+    }
+    m->cells[cy*m->cw + cx] &= ~(1 << item->type);
+}
+
+/**
+ * The MapItem at (x,y) of map m: from the table if it is there, otherwise the
+ * prototype for the layout tile the bitmaps show, or NULL. Empty tiles, the
+ * most common case, take one grid cell test and no table lookup.
+ */
+static MapItem* item_at(Map* m, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= m->w || y >= m->h) return NULL;                 // off the map; the key would alias a real tile
+    unsigned short mask = m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL];
+    if (!mask) return NULL;
+    int t = type_at(m, x, y, mask);
+    if (t == -1) return NULL;
+    MapItem* item = m->items->find(x*m->h + y);                                 // XY_KEY for map m
+    return item ? item : &proto[t];
+}
+
+/**
+ * What is drawn at (x,y) of map m, which must be active: the prototype
+ * MapItem of the entity there if there is one, otherwise as item_at.
+ */
+static MapItem* tile_at(Map* m, int x, int y)
 {
-    map[0].items = createHashTable(map_hash, NUMBUCKETS);                       // two hashtables, with two widths and heights defined in globals.h
-    map[1].items = createHashTable(map_hash, NUMBUCKETS);
-    map[0].w = WIDTH1;
-    map[0].h = HEIGHT1;
-    map[1].w = WIDTH2;
-    map[1].h = HEIGHT2;
+    int e = entity_at(x, y, -1);
+    return e == -1 ? item_at(m, x, y) : &proto[get_entities()->type[e]];
+}
+
+/**
+ * Put a copy of item at (x,y) on the active map, replacing anything that was
+ * already there, and record it in the spatial grid and bitmaps. Items off the
+ * map are dropped, since XY_KEY would alias them onto a real tile.
+ */
+static void place(int x, int y, const MapItem& item)
+{
+    Map* m = get_active_map();
+    if (x < 0 || y < 0 || x >= m->w || y >= m->h) return;
+    int t = type_at(m, x, y, m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL]);
+    MapItem old;
+    int r = m->items->insert(XY_KEY(x, y), item, &old);
+    if (r < 0) return;                                                          // out of memory
+    version++;
+    if (r) unmark(m, x, y, &old);                                               // If something was already there, clear it
+    else if (t != -1) unmark(m, x, y, &proto[t]);                               // a layout tile
+    m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL] |= 1 << item.type;
+    set_bit(m, item.type, x, y, 1);
+    set_bit(m, BLOCKED, x, y, !item.walkable);
+}
+
+// Most tiles place_run adds in one bulk insert
+#define RUN_MAX     64
+
+/**
+ * Add items at the n tiles with the given keys, all empty, in one bulk insert
+ * and mark them in the spatial grid and bitmaps. With step 0 every tile gets
+ * items[0], with step 1 tile k gets items[k]. Returns -1 if memory ran out.
+ */
+static int place_keys(Map* m, const unsigned* keys, const MapItem* items, int step, int n)
+{
+    if (!n) return 0;
+    int err = step ? m->items->insert_array(keys, items, n) : m->items->insert_run(keys, n, *items);
+    if (err) return -1;
+    for (int k = 0; k < n; k++, items += step) {
+        int x = keys[k] / m->h, y = keys[k] % m->h;                             // XY_KEY = x*h + y
+        m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL] |= 1 << items->type;
+        set_bit(m, items->type, x, y, 1);
+        set_bit(m, BLOCKED, x, y, !items->walkable);
+    }
+    version++;
+    return 0;
+}
+
+/**
+ * Put copies of item on len tiles in a line from (x,y) on the active map, as
+ * place() would. Tiles that are empty, which the bitmaps tell us without a
+ * lookup, are added in bulk; the rest go through place() to replace what is
+ * there.
+ */
+static void place_run(int x, int y, int dir, int len, const MapItem& item)
+{
+    Map* m = get_active_map();
+    unsigned keys[RUN_MAX];
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        int tx = dir == HORIZONTAL ? x+i : x, ty = dir == HORIZONTAL ? y : y+i;
+        if (tx < 0 || ty < 0 || tx >= m->w || ty >= m->h) continue;             // off the map
+        if (type_at(m, tx, ty, m->cells[(ty/MAP_CELL)*m->cw + tx/MAP_CELL]) != -1) {
+            place(tx, ty, item);                                                // occupied: replace it
+            continue;
+        }
+        keys[n++] = XY_KEY(tx, ty);
+        if (n == RUN_MAX) {
+            if (place_keys(m, keys, &item, 0, n)) return;                       // out of memory
+            n = 0;
+        }
+    }
+    place_keys(m, keys, &item, 0, n);
+}
+
+unsigned map_version()
+{
+    return version;
+}
+
+int map_walkable(int x, int y)
+{
+    Map* m = get_active_map();
+    if (x < 0 || y < 0 || x >= m->w || y >= m->h) return 0;
+    if (get_bit(m, BLOCKED, x, y)) return 0;
+    int e = entity_at(x, y, -1);
+    return e == -1 || proto[get_entities()->type[e]].walkable;
+}
+
+int map_has_type(int x, int y, int type)
+{
+    Map* m = get_active_map();
+    if (x < 0 || y < 0 || x >= m->w || y >= m->h) return 0;
+    return get_bit(m, type, x, y);
+}
+
+int map_check()
+{
+    for (int mi = 0; mi < num_maps; mi++) {
+        Map* m = maps[mi];
+        if (!m->resident) continue;                                             // nothing to check
+        for (int y = 0; y < m->h; y++) {
+            for (int x = 0; x < m->w; x++) {
+                const MapItem* item = m->items->peek(x*m->h + y);               // XY_KEY for map mi
+                int t = type_at(m, x, y, 0xFFFF);
+                if (!item && t != -1) item = &proto[t];                         // a layout tile
+                const char* err = NULL;
+                if (item && (item->type < 0 || item->type >= MAP_TYPES || !item->draw)) err = "bad item";
+                else if (get_bit(m, BLOCKED, x, y) != (item && !item->walkable)) err = "walkable bit";
+                else if (item && !(m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL] & (1 << item->type))) err = "grid cell";
+                for (int t = 0; !err && t < MAP_TYPES; t++) {
+                    if (get_bit(m, t, x, y) != (item && item->type == t)) err = "type bit";
+                }
+                if (err) {
+                    pc.printf("map_check: map %d (%d,%d): %s\r\n", mi, x, y, err);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void map_stats()
+{
+    for (int mi = 0; mi < num_maps; mi++) {
+        if (!maps[mi]->w) continue;                                             // not defined
+        if (!maps[mi]->resident) {
+            pc.printf("map %d: not resident, %d changes saved\r\n", mi, maps[mi]->saved_len);
+            continue;
+        }
+        HashTableStats st;
+        maps[mi]->items->stats(&st);
+        unsigned mean = st.used_buckets ? st.entries * 100 / st.used_buckets : 0;
+        unsigned long probes = st.lookups ? st.probes * 100 / st.lookups : 0;
+        pc.printf("map %d: %u entries, %u/%u buckets used, chain max %u mean %u.%02u peak %u, "
+                  "%lu lookups, %lu.%02lu probes/lookup\r\n",
+                  mi, st.entries, st.used_buckets, st.buckets, st.max_chain, mean / 100, mean % 100,
+                  st.peak_chain, st.lookups, probes / 100, probes % 100);
+    }
 }
 
 Map* get_active_map()
 {
-    return &map[active_map];                                                    // returns address of active map
+    return num_maps ? maps[active_map] : NULL;                                  // returns address of active map
+}
+
+/**
+ * Adapts a MapVisitor to MapTable::for_each, turning each key back into (x,y).
+ */
+struct VisitMapItem {
+    MapVisitor visit;
+    void* context;
+    int h;
+    void operator()(const unsigned& key, const MapItem& item) const { visit(key / h, key % h, &item, context); }
+};
+
+/**
+ * map_for_each for map m: the layout tiles that are still there, then the
+ * table.
+ */
+static void for_each_item(Map* m, MapVisitor visit, void* context)
+{
+    if (!m->resident) return;
+    for (int r = 0; r < m->layout_len; r++) {
+        const MapRun* run = &m->layout[r];
+        if (ENTITY_TYPES & (1 << run->type)) continue;                          // an entity
+        for (int i = 0; i < run->len; i++) {
+            int x = run->dir == HORIZONTAL ? run->x+i : run->x, y = run->dir == HORIZONTAL ? run->y : run->y+i;
+            if (x >= m->w || y >= m->h || !get_bit(m, run->type, x, y)) continue;   // off the map, or gone
+            if (m->items->peek(x*m->h + y)) continue;                           // replaced; visited with the table
+            visit(x, y, &proto[run->type], context);
+        }
+    }
+    VisitMapItem v = {visit, context, m->h};                                    // XY_KEY = x*h + y
+    m->items->for_each(v);
+}
+
+void map_for_each(MapVisitor visit, void* context)
+{
+    for_each_item(get_active_map(), visit, context);
+}
+
+/**
+ * Build map m, which must be active and empty, from its layout, adding its
+ * actors as entities if actors is set.
+ */
+static void build(Map* m, int actors)
+{
+    for (int r = 0; r < m->layout_len; r++) {
+        const MapRun* run = &m->layout[r];
+        for (int i = 0; i < run->len; i++) {
+            int x = run->dir == HORIZONTAL ? run->x+i : run->x, y = run->dir == HORIZONTAL ? run->y : run->y+i;
+            if (x >= m->w || y >= m->h) continue;                               // off the map
+            if (ENTITY_TYPES & (1 << run->type)) {                              // actors move, so they are entities rather than MapItems
+                if (actors && entity_add(run->type, x, y, proto[run->type].draw) == -1) {
+                    pc.printf("map %d: no room for the entity at (%d,%d)\r\n", m->index, x, y);
+                }
+            } else if (type_at(m, x, y, m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL]) != -1) {
+                place(x, y, proto[run->type]);                                  // overlaps an earlier tile: the table holds the winner
+            } else {
+                m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL] |= 1 << run->type;
+                set_bit(m, run->type, x, y, 1);
+                set_bit(m, BLOCKED, x, y, !proto[run->type].walkable);
+            }
+        }
+    }
+    version++;
+}
+
+// As you add more types, you'll need to add more items to this array.
+static const char lookup[] = {'1', '2', 'P', 'R', 'B', 'N', 'D', 'S', 'G', 'K', 'Q', 'H', 'O', 'Z', 'V'};  // used for serial debugging
+
+/**
+ * print_map's MapVisitor: marks the item in the character grid.
+ */
+static void print_item(int x, int y, const MapItem* item, void* grid)
+{
+    ((char*) grid)[y * (map_width() + 1) + x] = lookup[item->type];
+}
+
+void print_map()
+{
+    // Fill in a character grid from the MapItems and entities, then print it a
+    // row at a time, rather than looking up every tile
+    int w = map_width(), h = map_height();
+    char* grid = (char*) malloc(h * (w + 1));
+    if (!grid) return;
+    for (int y = 0; y < h; y++) {
+        memset(&grid[y * (w + 1)], ' ', w);
+        grid[y * (w + 1) + w] = '\0';
+    }
+    map_for_each(print_item, grid);
+    EntityList* ents = get_entities();
+    for (int e = 0; e < ents->count; e++) {
+        if (ents->map[e] == get_active_map() && ents->x[e] < w && ents->y[e] < h) grid[ents->y[e] * (w + 1) + ents->x[e]] = lookup[ents->type[e]];
+    }
+    for (int y = 0; y < h; y++) pc.printf("%s\r\n", &grid[y * (w + 1)]);
+    free(grid);
+}
+
+static unsigned char* put16(unsigned char* p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static unsigned get16(const unsigned char* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+/**
+ * MapVisitor that writes each item in image form.
+ */
+static void write_item(int x, int y, const MapItem* item, void* p)
+{
+    unsigned char* q = put16(put16(*(unsigned char**) p, x), y);
+    q[0] = item->type;
+    q[1] = item->walkable != 0;
+    *(unsigned char**) p = put16(put16(q + 2, item->data), (unsigned) item->data >> 16);
+}
+
+/**
+ * The MapItem written at p by write_item.
+ */
+static MapItem read_item(const unsigned char* p)
+{
+    MapItem item;
+    item.type = p[4];
+    item.draw = proto[item.type].draw;
+    item.walkable = p[5];
+    item.data = (int) (get16(p + 6) | get16(p + 8) << 16);
+    return item;
+}
+
+// Type of a saved change that erased a layout tile
+#define ERASED  0xFF
+
+/**
+ * Free the table, grid and bitmaps of map m.
+ */
+static void unload(Map* m)
+{
+    delete m->items;
+    free(m->cells);
+    free(m->bits);
+    m->items = NULL;
+    m->cells = NULL;
+    m->bits = NULL;
+    m->resident = 0;
+}
+
+/**
+ * Allocate the table, grid and bitmaps of map m, all empty. Returns 0, or -1
+ * if memory ran out, leaving m as it was.
+ */
+static int alloc(Map* m)
+{
+    m->items = new (std::nothrow) MapTable(NUMBUCKETS, MAP_MAX_LOAD);
+    m->cells = (unsigned short*) calloc(m->cw * m->ch, sizeof(unsigned short));
+    m->bits = (unsigned char*) calloc(MAP_TYPES + 1, m->stride);              // one bitmap per type, and BLOCKED
+    if (!m->items || !m->items->ok() || !m->cells || !m->bits) {
+        unload(m);
+        return -1;
+    }
+    m->resident = 1;
+    return 0;
+}
+
+/**
+ * Count the layout tiles of map m that have been erased, and write each one
+ * at p in image form if p is not NULL.
+ */
+static int erased_tiles(Map* m, unsigned char* p)
+{
+    int n = 0;
+    for (int r = 0; r < m->layout_len; r++) {
+        const MapRun* run = &m->layout[r];
+        if (ENTITY_TYPES & (1 << run->type)) continue;                          // an entity
+        for (int i = 0; i < run->len; i++) {
+            int x = run->dir == HORIZONTAL ? run->x+i : run->x, y = run->dir == HORIZONTAL ? run->y : run->y+i;
+            if (x >= m->w || y >= m->h || get_bit(m, run->type, x, y)) continue;   // off the map, or still there
+            if (m->items->peek(x*m->h + y)) continue;                           // replaced; saved with the table
+            n++;
+            if (!p) continue;
+            p = put16(put16(p, x), y);
+            memset(p, 0, MAP_IMAGE_ITEM - 4);
+            p[0] = ERASED;
+            p += MAP_IMAGE_ITEM - 4;
+        }
+    }
+    return n;
+}
+
+/**
+ * The number of changes map m holds from its layout: everything in the table
+ * and the layout tiles that were erased while it is resident, or what it
+ * saved while it is evicted.
+ */
+static int count_changes(Map* m)
+{
+    if (!m->resident) return m->saved_len;
+    return m->items->size() + erased_tiles(m, NULL);
+}
+
+/**
+ * Write the changes of map m at p in image item form, and return the end of
+ * what was written.
+ */
+static unsigned char* write_changes(Map* m, unsigned char* p)
+{
+    if (!m->resident) {
+        if (m->saved_len) memcpy(p, m->saved, m->saved_len * MAP_IMAGE_ITEM);
+        return p + m->saved_len * MAP_IMAGE_ITEM;
+    }
+    VisitMapItem v = {write_item, &p, m->h};                                    // XY_KEY = x*h + y
+    m->items->for_each(v);
+    return p + erased_tiles(m, p) * MAP_IMAGE_ITEM;
+}
+
+/**
+ * Apply n changes in image item form at p to the active map.
+ */
+static void apply_changes(const unsigned char* p, int n)
+{
+    for (int i = 0; i < n; i++, p += MAP_IMAGE_ITEM) {
+        if (p[4] == ERASED) map_erase(get16(p), get16(p + 2));
+        else place(get16(p), get16(p + 2), read_item(p));
+    }
+}
+
+/**
+ * Free map m after saving what differs from its layout. If there is no
+ * memory for the changes, the map just stays resident.
+ */
+static void evict(Map* m)
+{
+    int n = count_changes(m);
+    unsigned char* p = n ? (unsigned char*) malloc(n * MAP_IMAGE_ITEM) : NULL;
+    if (n && !p) return;
+    write_changes(m, p);
+    m->saved = p;
+    m->saved_len = n;
+    unload(m);
+}
+
+/**
+ * Make map mi resident and return it: build it from its layout the first
+ * time, or from its layout and saved changes after it was evicted. Returns
+ * NULL if there is no memory for it, leaving it as it was.
+ */
+static Map* load(int mi)
+{
+    Map* m = maps[mi];
+    if (m->resident) return m;
+    if (alloc(m)) return NULL;
+    int active = active_map;
+    active_map = mi;                                                            // place() and map_erase() work on the active map
+    build(m, !m->built);                                                        // its entities are still about after an eviction
+    m->built = 1;
+    apply_changes(m->saved, m->saved_len);
+    free(m->saved);
+    m->saved = NULL;
+    m->saved_len = 0;
+    active_map = active;
+    return m;
+}
+
+/**
+ * Free everything allocated for map m, and clear it.
+ */
+static void forget(Map* m)
+{
+    unload(m);
+    free(m->saved);
+    int index = m->index;
+    memset(m, 0, sizeof(Map));
+    m->index = index;
+}
+
+void maps_init()
+{
+    for (int mi = 0; mi < num_maps; mi++) forget(maps[mi]);
+    num_maps = 0;
+    active_map = 0;
+}
+
+void map_define(int m, int w, int h, int border, const MapRun* layout, int len, int flags)
+{
+    if (m < 0) return;
+    if (m >= max_maps) {                                                        // grow the registry
+        Map** grown = (Map**) realloc(maps, (m + 1) * sizeof(Map*));
+        if (!grown) return;
+        maps = grown;
+        for (; max_maps <= m; max_maps++) {
+            maps[max_maps] = (Map*) calloc(1, sizeof(Map));
+            if (!maps[max_maps]) return;
+            maps[max_maps]->index = max_maps;
+        }
+    }
+    if (m >= num_maps) num_maps = m + 1;                                        // slots skipped over were cleared by maps_init
+    Map* mp = maps[m];
+    forget(mp);
+    mp->w = w;
+    mp->h = h;
+    mp->cw = (w + MAP_CELL - 1) / MAP_CELL;                                     // spatial grid
+    mp->ch = (h + MAP_CELL - 1) / MAP_CELL;
+    mp->stride = (w * h + 7) / 8;                                               // occupancy bitmaps
+    mp->border = border;
+    mp->layout = layout;
+    mp->layout_len = len;
+    mp->flags = flags;
+}
+
+Map* get_map(int m)
+{
+    if(m >= 0 && m < num_maps && maps[m]->w) return maps[m];
+    return NULL;
 }
 
 Map* set_active_map(int m)
 {
+    if (!get_map(m)) return NULL;                                               // not defined
+    Map* old = maps[active_map];
+    if (m != active_map && old->resident && (old->flags & MAP_EVICT)) evict(old);   // leaving it
+    if (!load(m)) {                                                             // no memory for it: stay where we were
+        load(active_map);
+        return NULL;
+    }
     active_map = m;                                                             // sets active map by returning address of new active map
-    if(active_map == 0) return &map[0];
-    if(active_map == 1) return &map[1];
-    return NULL;
+    return maps[m];
 }
 
-void print_map()
+int map_resident(int m)
+{
+    Map* mp = get_map(m);
+    return mp && mp->resident;
+}
+
+DrawFunc map_border()
+{
+    return proto[get_active_map()->border].draw;
+}
+
+int map_image_size()
+{
+    int size = 5 + 1;
+    for (int mi = 0; mi < num_maps; mi++) size += 7 + count_changes(maps[mi]) * MAP_IMAGE_ITEM;
+    EntityList* ents = get_entities();
+    for (int e = 0; e < ents->count; e++) if (ents->map[e]) size += MAP_IMAGE_ENTITY;
+    return size;
+}
+
+int map_write_image(unsigned char* buf, int max)
 {
-    // As you add more types, you'll need to add more items to this array.
-    char lookup[] = {'1', '2', 'P', 'R', 'B', 'N', 'D', 'S', 'G', 'K', 'Q', 'H', 'O', 'Z'};  // used for serial debugging
-    for(int y = 0; y < map_height(); y++)
-    {
-        for (int x = 0; x < map_width(); x++)
-        {
-            MapItem* item = get_here(x,y);
-            if (item) pc.printf("%c", lookup[item->type]);
-            else pc.printf(" ");
+    if (map_image_size() > max) return -1;
+    unsigned char* p = buf;
+    memcpy(p, MAP_IMAGE_MAGIC, 4);
+    p[4] = num_maps;
+    p += 5;
+    for (int mi = 0; mi < num_maps; mi++) {
+        Map* m = maps[mi];
+        p = put16(put16(put16(p, m->w), m->h), count_changes(m));
+        *p++ = m->built;
+        p = write_changes(m, p);
+    }
+    EntityList* ents = get_entities();
+    unsigned char* count = p++;
+    *count = 0;
+    for (int e = 0; e < ents->count; e++) {
+        if (!ents->map[e]) continue;
+        p[0] = ents->map[e]->index;
+        p[1] = ents->type[e];
+        p = put16(put16(p + 2, ents->x[e]), ents->y[e]);
+        (*count)++;
+    }
+    return p - buf;
+}
+
+/**
+ * Check that img is a well-formed image for these maps. Returns 0 if so.
+ */
+static int check_image(const unsigned char* img, int len)
+{
+    const unsigned char* end = img + len;
+    if (len < 5 || memcmp(img, MAP_IMAGE_MAGIC, 4) || img[4] != num_maps) return -1;
+    const unsigned char* p = img + 5;
+    for (int mi = 0; mi < num_maps; mi++) {
+        if (end - p < 7) return -1;
+        int w = get16(p), h = get16(p + 2), n = get16(p + 4), built = p[6];
+        p += 7;
+        if (w != maps[mi]->w || h != maps[mi]->h || built > 1 || (n && !built)) return -1;
+        if (end - p < n * MAP_IMAGE_ITEM) return -1;
+        for (int i = 0; i < n; i++, p += MAP_IMAGE_ITEM) {
+            if ((int) get16(p) >= w || (int) get16(p + 2) >= h) return -1;
+            if (p[4] == ERASED) continue;
+            if (p[4] >= MAP_TYPES || (ENTITY_TYPES & (1 << p[4])) || !proto[p[4]].draw) return -1;
         }
-        pc.printf("\r\n");
     }
+    if (end - p < 1 || end - p != 1 + p[0] * MAP_IMAGE_ENTITY) return -1;
+    for (int e = 0, n = p[0]; e < n; e++) {
+        const unsigned char* q = p + 1 + e * MAP_IMAGE_ENTITY;
+        if (q[0] >= num_maps || q[1] >= MAP_TYPES || !proto[q[1]].draw) return -1;
+        if ((int) get16(q + 2) >= maps[q[0]]->w || (int) get16(q + 4) >= maps[q[0]]->h) return -1;
+    }
+    return 0;
+}
+
+int map_read_image(const unsigned char* img, int len)
+{
+    if (check_image(img, len)) return -1;
+    for (int mi = 0; mi < num_maps; mi++) {
+        if (maps[mi]->built) return -1;                                         // its entities are live, even while it is evicted
+    }
+    const unsigned char* p = img + 5;
+    for (int mi = 0; mi < num_maps; mi++) {                                     // each map's changes, as if it had been evicted
+        Map* m = maps[mi];
+        int n = get16(p + 4);
+        if (n && !(m->saved = (unsigned char*) malloc(n * MAP_IMAGE_ITEM))) {
+            while (mi--) {                                                      // out of memory: undo
+                free(maps[mi]->saved);
+                maps[mi]->saved = NULL;
+                maps[mi]->saved_len = 0;
+                maps[mi]->built = 0;
+            }
+            return -1;
+        }
+        if (n) memcpy(m->saved, p + 7, n * MAP_IMAGE_ITEM);
+        m->saved_len = n;
+        m->built = p[6];                                                        // its actors are in the image's entities
+        p += 7 + n * MAP_IMAGE_ITEM;
+    }
+    int active = active_map;
+    for (int e = 0, n = *p++; e < n; e++, p += MAP_IMAGE_ENTITY) {
+        active_map = p[0];
+        entity_add(p[1], get16(p + 2), get16(p + 4), proto[p[1]].draw);
+    }
+    active_map = active;
+    return 0;
+}
+
+int map_save(const char* path)
+{
+    int size = map_image_size();
+    unsigned char* buf = (unsigned char*) malloc(size);
+    if (!buf) return -1;
+    map_write_image(buf, size);
+    FILE* f = fopen(path, "wb");
+    int err = !f || fwrite(buf, size, 1, f) != 1;
+    if (f && fclose(f)) err = 1;
+    free(buf);
+    return err ? -1 : 0;
+}
+
+int map_load(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* buf = size > 0 ? (unsigned char*) malloc(size) : NULL;
+    int err = !buf || fread(buf, size, 1, f) != 1;                              // the whole image in one read
+    fclose(f);
+    if (!err) err = map_read_image(buf, size);
+    free(buf);
+    return err ? -1 : 0;
 }
 
 int map_width()
@@ -99,206 +810,299 @@ int map_area()
 MapItem* get_north(int x, int y)
 {
     Map *map = get_active_map();                                                // gets active map
-    int key = XY_KEY(x,y-1);                                                    // gets key of tile to north
-    return (MapItem*) getItem(map->items,key);                                  // uses getItem to return object type as MapItem*
+    return tile_at(map, x, y-1);                                                // MapItem of tile to north
 }
 
 MapItem* get_south(int x, int y)
 {
     Map *map = get_active_map();                                                // gets active map
-    int key = XY_KEY(x,y+1);                                                    // gets key of tile to south
-    return (MapItem*) getItem(map->items,key);                                  // uses getItem to return object type as MapItem*
+    return tile_at(map, x, y+1);                                                // MapItem of tile to south
 }
 
 MapItem* get_east(int x, int y)
 {
     Map *map = get_active_map();                                                // gets active map
-    int key = XY_KEY(x+1,y);                                                    // gets key of tile to east
-    return (MapItem*) getItem(map->items,key);                                  // uses getItem to return object type as MapItem*
+    return tile_at(map, x+1, y);                                                // MapItem of tile to east
 }
 
 MapItem* get_west(int x, int y)
 {
     Map *map = get_active_map();                                                // gets active map
-    int key = XY_KEY(x-1,y);                                                    // gets key of tile to west
-    return (MapItem*) getItem(map->items,key);                                  // uses getItem to return object type as MapItem*
+    return tile_at(map, x-1, y);                                                // MapItem of tile to west
 }
 
 MapItem* get_here(int x, int y)
 {
     Map *map = get_active_map();                                                // gets active map
-    int key = XY_KEY(x,y);                                                      // gets key of tile player is standing on
-    return (MapItem*) getItem(map->items,key);                                  // uses getItem to return object type as MapItem*
+    return tile_at(map, x, y);                                                  // MapItem of tile player is standing on
 }
 
 void map_erase(int x, int y)
 {
+    if (x < 0 || y < 0 || x >= map_width() || y >= map_height()) return;       // off the map; the key would alias a real tile
+    Map* m = get_active_map();
     unsigned int key = XY_KEY(x,y);                                             // gets key of tile defined by x,y arguments
-    free((MapItem*)removeItem(map[active_map].items,key));                      // uses removeItem to clear tile
+    MapItem item;
+    int t;
+    if (m->items->remove(key, &item)) {                                         // clears the tile
+        version++;
+        unmark(m, x, y, &item);
+    } else if ((t = type_at(m, x, y, m->cells[(y/MAP_CELL)*m->cw + x/MAP_CELL])) != -1) {
+        version++;                                                              // a layout tile: just clear its bits
+        unmark(m, x, y, &proto[t]);
+    }
 }
 
-void add_wall1(int x, int y, int dir, int len)                                  // wall1 used for surrounding walls on map 0
+void map_clear(int x, int y)
 {
-    for(int i = 0; i < len; i++)
-    {
-        MapItem* w1 = (MapItem*) malloc(sizeof(MapItem));
-        w1->type = TREE;
-        w1->draw = draw_wall1;
-        w1->walkable = false;
-        w1->data = 0;
-        unsigned key = (dir == HORIZONTAL) ? XY_KEY(x+i, y) : XY_KEY(x, y+i);
-        void* val = insertItem(get_active_map()->items, key, w1);
-        if (val) free(val); // If something is already there, free it
+    int e = entity_at(x, y, -1);
+    if (e == -1) {
+        map_erase(x, y);
+        return;
     }
+    entity_remove(e);
+    version++;
 }
 
-void add_wall2(int x, int y, int dir, int len)                                  // wall2 used for surrounding and inner walls on map 1
+int map_push(int x, int y, int dx, int dy)
 {
-    for(int i = 0; i < len; i++)
-    {
-        MapItem* w2 = (MapItem*) malloc(sizeof(MapItem));
-        w2->type = DUNGEONBRICK;
-        w2->draw = draw_wall2;
-        w2->walkable = false;
-        w2->data = 0;
-        unsigned key = (dir == HORIZONTAL) ? XY_KEY(x+i, y) : XY_KEY(x, y+i);
-        void* val = insertItem(get_active_map()->items, key, w2);
-        if (val) free(val); // If something is already there, free it
+    int e = entity_at(x, y, -1);
+    if (e == -1 || !map_walkable(x + dx, y + dy) || entity_at(x + dx, y + dy, -1) != -1) return 0;
+    entity_move(e, x + dx, y + dy);
+    version++;
+    return 1;
+}
+
+/**
+ * Where scan() puts what it finds: up to max hits in order, and if nearest is
+ * not NULL, the hit closest to (ox,oy).
+ */
+typedef struct {
+    MapHit* hits;
+    int n, max;
+    int ox, oy;
+    MapHit* nearest;
+    int best;
+} ScanOut;
+
+static void hit(ScanOut* out, int x, int y, int type, MapItem* item, int e)
+{
+    MapHit h;
+    h.x = x;
+    h.y = y;
+    h.type = type;
+    h.item = item;
+    h.entity = e;
+    if (out->n < out->max) out->hits[out->n] = h;
+    out->n++;
+    if (out->nearest) {
+        int d = (x-out->ox)*(x-out->ox) + (y-out->oy)*(y-out->oy);
+        if (out->best == -1 || d < out->best) {
+            out->best = d;
+            *out->nearest = h;
+        }
     }
 }
 
-void add_river(int x, int y, int dir, int len)                                  // river used to block access to 2nd quest area in map 0
+/**
+ * Shared scan behind the queries: every MapItem and entity of the given type
+ * (or any type if type is -1) in the rectangle, optionally limited to within
+ * r of (ox,oy). Only grid cells whose mask matches are scanned.
+ */
+static void scan(int type, int x0, int y0, int x1, int y1, int r, ScanOut* out)
+{
+    int ox = out->ox, oy = out->oy;
+    Map* m = get_active_map();
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= m->w) x1 = m->w - 1;
+    if (y1 >= m->h) y1 = m->h - 1;
+    unsigned short want = type == -1 ? 0xFFFF : 1 << type;
+    for (int cy = y0 / MAP_CELL; cy <= y1 / MAP_CELL; cy++) {
+        for (int cx = x0 / MAP_CELL; cx <= x1 / MAP_CELL; cx++) {
+            if (!(m->cells[cy*m->cw + cx] & want)) continue;                    // nothing we want in this block
+            for (int y = cy*MAP_CELL; y < (cy+1)*MAP_CELL && y <= y1; y++) {
+                if (y < y0) continue;
+                for (int x = cx*MAP_CELL; x < (cx+1)*MAP_CELL && x <= x1; x++) {
+                    if (x < x0) continue;
+                    if (r >= 0 && (x-ox)*(x-ox) + (y-oy)*(y-oy) > r*r) continue;
+                    // Bit tests only; the HashTable is read just for hits
+                    int t = type_at(m, x, y, m->cells[cy*m->cw + cx] & want);
+                    if (t != -1) hit(out, x, y, t, item_at(m, x, y), -1);
+                }
+            }
+        }
+    }
+    EntityList* ents = get_entities();                                          // entities are few, so check them directly
+    for (int e = 0; e < ents->count; e++) {
+        int x = ents->x[e], y = ents->y[e];
+        if (ents->map[e] != m || (type != -1 && ents->type[e] != type)) continue;
+        if (x < x0 || x > x1 || y < y0 || y > y1) continue;
+        if (r >= 0 && (x-ox)*(x-ox) + (y-oy)*(y-oy) > r*r) continue;
+        hit(out, x, y, ents->type[e], NULL, e);
+    }
+}
+
+int map_query_rect(int type, int x0, int y0, int x1, int y1, MapHit* hits, int max)
 {
-    for(int i = 0; i < len; i++)
-    {
-        MapItem* river = (MapItem*) malloc(sizeof(MapItem));
-        river->type = RIVER;
-        river->draw = draw_river;
-        river->walkable = false;
-        river->data = 0;
-        unsigned key = (dir == HORIZONTAL) ? XY_KEY(x+i, y) : XY_KEY(x, y+i);
-        void* val = insertItem(get_active_map()->items, key, river);
-        if (val) free(val); // If something is already there, free it
+    ScanOut out = {hits, 0, max, 0, 0, NULL, -1};
+    scan(type, x0, y0, x1, y1, -1, &out);
+    return out.n;
+}
+
+int map_query_radius(int type, int x, int y, int r, MapHit* hits, int max)
+{
+    ScanOut out = {hits, 0, max, x, y, NULL, -1};
+    scan(type, x-r, y-r, x+r, y+r, r, &out);
+    return out.n;
+}
+
+int map_nearest(int type, int x, int y, int max_r, MapHit* nearest)
+{
+    // Widen the search until something turns up. Anything within radius r is
+    // nearer than anything outside it, so the first hit found is the answer.
+    MapHit h;
+    ScanOut out = {NULL, 0, 0, x, y, &h, -1};
+    for (int r = 0; ; r = r ? r*2 : 1) {
+        if (r > max_r) r = max_r;
+        scan(type, x-r, y-r, x+r, y+r, r, &out);
+        if (out.n) {
+            if (nearest) *nearest = h;
+            return 1;
+        }
+        if (r == max_r) return 0;
     }
 }
 
+/**
+ * Add an entity of the given type at (x,y) on the active map, replacing any
+ * entity already there. Like place(), anything off the map is dropped.
+ */
+static void add_actor(int type, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= map_width() || y >= map_height()) return;
+    int e = entity_at(x, y, -1);
+    if (e != -1) entity_remove(e);
+    entity_add(type, x, y, proto[type].draw);
+    version++;
+}
+
+void add_wall1(int x, int y, int dir, int len)                                  // wall1 used for surrounding walls on map 0
+{
+    MapItem w1;
+    w1.type = TREE;
+    w1.draw = draw_wall1;
+    w1.walkable = false;
+    w1.data = 0;
+    place_run(x, y, dir, len, w1);
+}
+
+void add_wall2(int x, int y, int dir, int len)                                  // wall2 used for surrounding and inner walls on map 1
+{
+    MapItem w2;
+    w2.type = DUNGEONBRICK;
+    w2.draw = draw_wall2;
+    w2.walkable = false;
+    w2.data = 0;
+    place_run(x, y, dir, len, w2);
+}
+
+void add_river(int x, int y, int dir, int len)                                  // river used to block access to 2nd quest area in map 0
+{
+    MapItem river;
+    river.type = RIVER;
+    river.draw = draw_river;
+    river.walkable = false;
+    river.data = 0;
+    place_run(x, y, dir, len, river);
+}
+
 void add_flag(int x, int y)                                                     // flag used as waypoint marker
 {
-    MapItem* flag = (MapItem*) malloc(sizeof(MapItem));
-    flag->type = FLAG;
-    flag->draw = draw_flag;
-    flag->walkable = true;
-    flag->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), flag);
-    if (val) free(val); // If something is already there, free it
+    MapItem flag;
+    flag.type = FLAG;
+    flag.draw = draw_flag;
+    flag.walkable = true;
+    flag.data = 0;
+    place(x, y, flag);
 }
 
 void add_plant(int x, int y)                                                    // plants used as scenery in map 0 to see movement
 {
-    MapItem* plant = (MapItem*) malloc(sizeof(MapItem));
-    plant->type = PLANT;
-    plant->draw = draw_plant;
-    plant->walkable = true;
-    plant->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), plant);
-    if (val) free(val); // If something is already there, free it
+    MapItem plant;
+    plant.type = PLANT;
+    plant.draw = draw_plant;
+    plant.walkable = true;
+    plant.data = 0;
+    place(x, y, plant);
 }
 
 void add_gate1(int x, int y)                                                    // gate1 used as door until quest 1 complete
 {
-    MapItem* gate1 = (MapItem*) malloc(sizeof(MapItem));
-    gate1->type = GATE1;
-    gate1->draw = draw_gate1;
-    gate1->walkable = false;
-    gate1->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), gate1);
-    if (val) free(val); // If something is already there, free it
+    MapItem gate1;
+    gate1.type = GATE1;
+    gate1.draw = draw_gate1;
+    gate1.walkable = false;
+    gate1.data = 0;
+    place(x, y, gate1);
 }
 
 void add_gate2(int x, int y)                                                    // gate2 used as door until quest 2 complete
 {
-    MapItem* gate2 = (MapItem*) malloc(sizeof(MapItem));
-    gate2->type = GATE2;
-    gate2->draw = draw_gate2;
-    gate2->walkable = false;
-    gate2->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), gate2);
-    if (val) free(val); // If something is already there, free it
+    MapItem gate2;
+    gate2.type = GATE2;
+    gate2.draw = draw_gate2;
+    gate2.walkable = false;
+    gate2.data = 0;
+    place(x, y, gate2);
 }
 
 void add_NPC(int x, int y)                                                      // NPC character which gives player dialogue and quests
 {
-    MapItem* npc = (MapItem*) malloc(sizeof(MapItem));
-    npc->type = NPC;
-    npc->draw = draw_NPC;
-    npc->walkable = false;
-    npc->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), npc);
-    if (val) free(val); // If something is already there, free it
+    add_actor(NPC, x, y);
 }
 
 void add_slime(int x, int y)                                                    // slime which needs to be collected for quest 1
 {
-    MapItem* slime = (MapItem*) malloc(sizeof(MapItem));
-    slime->type = SLIME;
-    slime->draw = draw_slime;
-    slime->walkable = false;
-    slime->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), slime);
-    if (val) free(val); // If something is already there, free it
+    add_actor(SLIME, x, y);
 }
 
 void add_ghost(int x, int y)                                                    // ghosts which need to be avoided for quest 2
 {
-    MapItem* ghost = (MapItem*) malloc(sizeof(MapItem));
-    ghost->type = GHOST;
-    ghost->draw = draw_ghost;
-    ghost->walkable = true;
-    ghost->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), ghost);
-    if (val) free(val); // If something is already there, free it
+    add_actor(GHOST, x, y);
 }
 
 void add_key(int x, int y)                                                      // key item used to access room for final zone
 {
-    MapItem* key = (MapItem*) malloc(sizeof(MapItem));
-    key->type = KEY;
-    key->draw = draw_key;
-    key->walkable = false;
-    key->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), key);
-    if (val) free(val); // If something is already there, free it
+    MapItem key;
+    key.type = KEY;
+    key.draw = draw_key;
+    key.walkable = false;
+    key.data = 0;
+    place(x, y, key);
 }
 
 void add_rock(int x, int y)                                                     // movable rock used to block gate after quest 1
 {
-    MapItem* rock = (MapItem*) malloc(sizeof(MapItem));
-    rock->type = ROCK;
-    rock->draw = draw_rock;
-    rock->walkable = false;
-    rock->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), rock);
-    if (val) free(val); // If something is already there, free it
+    add_actor(ROCK, x, y);
 }
 
 void add_heart(int x, int y)                                                     // heart item that increases amount of lives
 {
-    MapItem* heart = (MapItem*) malloc(sizeof(MapItem));
-    heart->type = HEART;
-    heart->draw = draw_heart;
-    heart->walkable = false;
-    heart->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x, y), heart);
-    if (val) free(val); // If something is already there, free it
+    MapItem heart;
+    heart.type = HEART;
+    heart.draw = draw_heart;
+    heart.walkable = false;
+    heart.data = 0;
+    place(x, y, heart);
 }
 
 void add_portal(int x, int y)                                                   // portal used for switching between maps
 {
-    MapItem* portal = (MapItem*) malloc(sizeof(MapItem));
-    portal->type = PORTAL;
-    portal->draw = draw_portal;
-    portal->walkable = false;
-    portal->data = 0;
-    void* val = insertItem(get_active_map()->items, XY_KEY(x,y), portal);
-    if (val) free(val); // If something is already there, free it
+    MapItem portal;
+    portal.type = PORTAL;
+    portal.draw = draw_portal;
+    portal.walkable = false;
+    portal.data = 0;
+    place(x, y, portal);
 }
\ No newline at end of file
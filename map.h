@@ -68,35 +68,123 @@ typedef struct {
 #define KEY     12
 #define ROCK    13
 #define HEART   14
+
+// Number of MapItem types; one more than the highest type above
+#define MAP_TYPES   15
+
+/**
+ * The hash for the map tables: the XY_KEY itself, which HashMap takes modulo
+ * the number of buckets. Here rather than in map.cpp so ht_bench can time
+ * the same table.
+ */
+struct MapHash {
+    unsigned operator()(unsigned key) const { return key; }
+};
+
+// Mean chain length at which a map table grows; it starts with NUMBUCKETS
+// buckets and more than doubles each time
+#define MAP_MAX_LOAD    2
+
+// Directions, for using the modification functions
+#define HORIZONTAL  0
+#define VERTICAL    1
+
 /**
- * Initializes the internal structures for all maps. This does not populate
- * the map with items, but allocates space for them, initializes the hash tables, 
- * and sets the width and height.
+ * One entry of a static map layout: len tiles of the given type in a line
+ * from (x,y), in direction dir. A single item is a run of length 1. Tiles of
+ * type GHOST become entities.
+ */
+typedef struct {
+    unsigned char type;
+    unsigned char x, y;
+    unsigned char dir;
+    unsigned char len;
+} MapRun;
+
+// Layout entries: a line of tiles, and a single tile
+#define MAP_RUN(type, x, y, dir, len)   {type, x, y, dir, len}
+#define MAP_AT(type, x, y)              {type, x, y, HORIZONTAL, 1}
+
+/**
+ * Forget every map, freeing anything allocated for them. Maps are then added
+ * with map_define.
  */
 void maps_init();
 
+// Flags for map_define
+#define MAP_EVICT   1                   // free the map whenever the player leaves it
+
+/**
+ * Define map m, w by h tiles, adding it to the registry of maps; there can be
+ * any number of them, with up to 255 in a map image. Redefining a map forgets
+ * what was there. border is the type of MapItem drawn beyond its edges.
+ *
+ * A map is built from a static layout: a const array the compiler places in
+ * flash. Nothing is allocated until the map is first made active, when it is
+ * built from the layout and its actors (see ENTITY_TYPES in entity.h) are
+ * added as entities. The layout is read in place rather than copied into the
+ * HashTable; only tiles that are later replaced, and items added at run time,
+ * take up heap. Later entries win where runs overlap, as with the add_*
+ * functions. The layout must stay valid while the map is defined; it can be
+ * NULL for an empty map.
+ *
+ * With MAP_EVICT, leaving the map frees its HashTable, grid and bitmaps, after
+ * saving just what differs from the layout: items added or replaced, and
+ * layout tiles erased. Entering it again rebuilds it from the two. Its
+ * entities stay where they are in the meantime.
+ */
+void map_define(int m, int w, int h, int border, const MapRun* layout, int len, int flags);
+
 /**
  * Returns a pointer to the active map.
  */
 Map* get_active_map();
 
 /**
- * Sets the active map to map m, where m is the index of the map to activate.
- * Returns a pointer to the new active map.
+ * Sets the active map to map m, where m is the index of the map to activate,
+ * building it if it is not resident and evicting the map that was active if
+ * it was defined with MAP_EVICT. Returns a pointer to the new active map, or
+ * NULL (leaving the active map as it was) if map m is not defined or there is
+ * no memory to build it.
  */
 Map* set_active_map(int m);
 
 /**
- * Returns the map m, regardless of whether it is the active map. This function
- * does not change the active map.
+ * Returns the map m, regardless of whether it is the active map or resident.
+ * This function does not change the active map.
  */
 Map* get_map(int m);
 
+/**
+ * Returns 1 if map m is resident (built and not evicted), or 0 if not.
+ */
+int map_resident(int m);
+
+/**
+ * Returns the drawing function for the tiles beyond the edges of the active
+ * map.
+ */
+DrawFunc map_border();
+
 /**
  * Print the active map to the serial console.
  */
 void print_map();
 
+/**
+ * A function called by map_for_each with the location of a MapItem, the item,
+ * and the context pointer that was passed to map_for_each. The item may be
+ * shared by every tile of its type, so it is read-only.
+ */
+typedef void (*MapVisitor)(int x, int y, const MapItem* item, void* context);
+
+/**
+ * Call visit once for every MapItem on the active map, in no particular order.
+ * This takes time in proportion to the number of MapItems rather than the
+ * area of the map. visit must not look up, add or erase MapItems.
+ */
+void map_for_each(MapVisitor visit, void* context);
+
 // Access
 /**
  * Returns the width of the active map.
@@ -114,7 +202,9 @@ int map_height();
 int map_area();
 
 /**
- * Returns the MapItem immediately above the given location.
+ * Returns the MapItem immediately above the given location. These get_*
+ * functions report what is drawn on the tile: for a tile with an entity on it,
+ * the shared prototype MapItem of the entity's type.
  */
 MapItem* get_north(int x, int y);
 
@@ -138,15 +228,150 @@ MapItem* get_west(int x, int y);
  */
 MapItem* get_here(int x, int y);
 
-// Directions, for using the modification functions
-#define HORIZONTAL  0
-#define VERTICAL    1
+/**
+ * Returns a counter that changes whenever a MapItem is added to or erased
+ * from any map, or an entity is added, pushed or removed through the map
+ * functions, so derived data (like a distance field) can tell it is stale.
+ * Ghosts stepping about do not change it.
+ */
+unsigned map_version();
+
+/**
+ * Returns 1 if the player could stand on (x,y) of the active map: the tile is
+ * empty or holds a walkable MapItem, and any entity there is a ghost. Tiles
+ * off the map are not walkable. This is a bit test and a look in one cell of
+ * the entity index, and never touches the HashTable.
+ */
+int map_walkable(int x, int y);
+
+/**
+ * Returns 1 if there is a MapItem of the given type at (x,y) of the active
+ * map. Like map_walkable, this is a single bit test.
+ */
+int map_has_type(int x, int y, int type);
+
+/**
+ * Check that the HashTable, spatial grid and bitmaps of every resident map
+ * agree, and that every MapItem is sane. Prints the first problem found to the
+ * serial console and returns -1, or returns 0. Slow: it looks up every tile.
+ */
+int map_check();
+
+/**
+ * Map images: how each map differs from its layout, and every entity, in a
+ * flat, relocatable form. A map's layout is not stored; the image is read
+ * over the same layouts it was written from. Each change is a MapItem that
+ * replaced or was added to the layout, or a layout tile that was erased, as
+ * an evicted map keeps them. All numbers are little-endian:
+ *
+ *   "GIM2", then a byte for the number of maps (an undefined one is 0x0)
+ *   for each map: u16 width, u16 height, u16 number of changes, u8 built
+ *     (0 if the map was never entered, and then it has no changes), then per
+ *     change u16 x, u16 y, u8 type (0xFF for an erased tile), u8 walkable,
+ *     s32 data
+ *   u8 number of entities, then per entity u8 map, u8 type, u16 x, u16 y
+ *
+ * Drawing functions are not stored; they follow from the type.
+ */
+#define MAP_IMAGE_MAGIC     "GIM2"
+#define MAP_IMAGE_ITEM      10
+#define MAP_IMAGE_ENTITY    6
+
+/**
+ * Returns the size in bytes of the image of the maps as they are now. Maps
+ * that are not resident are written from the changes they saved, so this and
+ * map_write_image build nothing.
+ */
+int map_image_size();
+
+/**
+ * Write the image of the maps to buf. Returns its size, or -1 if it needs more
+ * than max bytes.
+ */
+int map_write_image(unsigned char* buf, int max);
+
+/**
+ * Add the changes and entities in an image to the maps, which must be defined
+ * with the layouts the image was written from, and never built. Nothing is
+ * built here: each map keeps its changes from the image as an evicted map
+ * keeps its own, and set_active_map builds it from its layout with them on
+ * top. The image can be anywhere in memory, including flash, but it is
+ * copied into the maps rather than used in place: lookups go through each
+ * map's table and bitmaps, which the flat records cannot serve. Returns 0, or
+ * -1 without changing anything if the image is malformed, made for maps of
+ * other sizes or there is no memory for it, or if any map has been built,
+ * evicted ones included, since their entities are still live.
+ */
+int map_read_image(const unsigned char* img, int len);
+
+/**
+ * Save the image of the maps to a file. Returns 0 on success.
+ */
+int map_save(const char* path);
+
+/**
+ * Load the maps from an image file with a single read, as map_read_image.
+ * Returns 0 on success.
+ */
+int map_load(const char* path);
+
+/**
+ * Print the HashTable statistics of every map to the serial console: entries,
+ * buckets in use, longest and mean chain, and lookups with the mean number of
+ * entries compared per lookup. For a map that is not resident, print how many
+ * changes are saved for it instead.
+ */
+void map_stats();
+
+// Side length, in tiles, of one block of the spatial grid used by the queries
+#define MAP_CELL    8
+
+/**
+ * One result of a spatial query: a MapItem or an entity, with its location.
+ */
+typedef struct {
+    int x, y;
+    int type;
+    MapItem* item;  // The MapItem, or NULL if this is an entity
+    int entity;     // Index into the entity list, or -1 if this is a MapItem
+} MapHit;
+
+/**
+ * Find everything of the given type (-1 for any type) in the rectangle from
+ * (x0,y0) to (x1,y1) inclusive on the active map, entities included. Up to
+ * max hits are stored in hits. Returns the total number found, which may be
+ * more than max.
+ */
+int map_query_rect(int type, int x0, int y0, int x1, int y1, MapHit* hits, int max);
+
+/**
+ * As map_query_rect, but for everything within distance r of (x,y).
+ */
+int map_query_radius(int type, int x, int y, int r, MapHit* hits, int max);
+
+/**
+ * Find the nearest MapItem or entity of the given type within distance max_r
+ * of (x,y). Returns 1 and fills in nearest if one was found, 0 otherwise.
+ */
+int map_nearest(int type, int x, int y, int max_r, MapHit* nearest);
 
 /**
  * If there is a MapItem at (x,y), remove it from the map.
  */
 void map_erase(int x, int y);
 
+/**
+ * Remove what is drawn at (x,y) of the active map: the entity there if there
+ * is one, otherwise the MapItem, as map_erase.
+ */
+void map_clear(int x, int y);
+
+/**
+ * Move the entity at (x,y) of the active map by (dx,dy), if the tile there is
+ * walkable and holds no other entity. Returns 1 if it moved.
+ */
+int map_push(int x, int y, int dx, int dy);
+
 /**
  * Add WALL items in a line of length len beginning at (x,y).
  * If dir == HORIZONTAL, the line is in the direction of increasing x.
@@ -177,7 +402,8 @@ void add_heart(int x, int y);
 // WALKABLE
 void add_flag(int x, int y);
 
-// CHARACTERS
+// CHARACTERS, and the ROCK above: entities rather than MapItems, replacing
+// any entity already on the tile
 void add_NPC(int x, int y);
 void add_slime(int x, int y);
 void add_ghost(int x, int y);
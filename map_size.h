@@ -0,0 +1,12 @@
+#ifndef MAP_SIZE_H
+#define MAP_SIZE_H
+
+// Map dimensions and the starting bucket count of the map tables. Kept apart
+// from globals.h, which pulls in mbed.h, so ht_bench.cpp can build on a host.
+#define HEIGHT1 50
+#define WIDTH1  50
+#define HEIGHT2 24
+#define WIDTH2  25
+#define NUMBUCKETS 7
+
+#endif // MAP_SIZE_H
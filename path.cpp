@@ -0,0 +1,190 @@
+#include "path.h"
+
+#include "globals.h"
+#include "map.h"
+
+// Per-tile search state in node[]
+#define DIR_MASK    0x03        // direction of the move into this tile
+#define CLOSED      0x04        // expanded; its parent is final
+
+/**
+ * Open set entry. tile is the tile index (y*w + x) in the low 12 bits and the
+ * direction of the move into it above that; g is the cost so far.
+ */
+typedef struct {
+    unsigned short tile;
+    unsigned short g;
+} OpenEntry;
+
+static const int step_x[4] = {0, 0, 1, -1};    // N, S, E, W
+static const int step_y[4] = {-1, 1, 0, 0};
+
+/**
+ * The search in flight. The open set is a binary min-heap on g + h, where h is
+ * the Manhattan distance to the target. Tiles may be in the heap more than
+ * once; stale entries are skipped when they come out closed.
+ */
+static unsigned char node[PATH_MAX_AREA];
+static OpenEntry heap[PATH_OPEN_MAX];
+static int heap_n;
+static int w, h;
+static int start, target;
+static int status;
+
+static int cost(OpenEntry e)
+{
+    int t = e.tile & 0xFFF;
+    int x = t % w, y = t / w;
+    int hx = x - target % w, hy = y - target / w;
+    return e.g + (hx < 0 ? -hx : hx) + (hy < 0 ? -hy : hy);
+}
+
+/**
+ * Heap order: lower cost first, and among equal costs the deeper entry, which
+ * heads straight for the target instead of widening the front.
+ */
+static int before(OpenEntry a, OpenEntry b)
+{
+    int ca = cost(a), cb = cost(b);
+    return ca < cb || (ca == cb && a.g > b.g);
+}
+
+static int push(int tile, int dir, int g)
+{
+    if (heap_n == PATH_OPEN_MAX) return -1;
+    OpenEntry e;
+    e.tile = tile | (dir << 12);
+    e.g = g;
+    int i = heap_n++;
+    while (i > 0 && before(e, heap[(i-1)/2])) {
+        heap[i] = heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    heap[i] = e;
+    return 0;
+}
+
+static OpenEntry pop()
+{
+    OpenEntry top = heap[0];
+    OpenEntry last = heap[--heap_n];
+    int i = 0;
+    while (1) {
+        int c = 2*i + 1;
+        if (c >= heap_n) break;
+        if (c+1 < heap_n && before(heap[c+1], heap[c])) c++;
+        if (!before(heap[c], last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+void path_begin(int sx, int sy, int tx, int ty)
+{
+    w = map_width();
+    h = map_height();
+    heap_n = 0;
+    status = PATH_FAILED;
+    if (w * h > PATH_MAX_AREA) return;
+    if (sx < 0 || sy < 0 || sx >= w || sy >= h) return;
+    if (tx < 0 || ty < 0 || tx >= w || ty >= h) return;
+    memset(node, 0, w * h);
+    start = sy * w + sx;
+    target = ty * w + tx;
+    status = PATH_RUNNING;
+    push(start, 0, 0);
+}
+
+int path_step(int max_nodes)
+{
+    while (status == PATH_RUNNING && max_nodes-- > 0) {
+        if (!heap_n) {
+            status = PATH_FAILED;
+            break;
+        }
+        OpenEntry e = pop();
+        int t = e.tile & 0xFFF;
+        if (node[t] & CLOSED) continue;                                         // stale duplicate
+        node[t] = CLOSED | (e.tile >> 12);
+        if (t == target) {
+            status = PATH_FOUND;
+            break;
+        }
+        int x = t % w, y = t / w;
+        for (int d = 0; d < 4; d++) {
+            int nx = x + step_x[d], ny = y + step_y[d];
+            if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+            int n = ny * w + nx;
+            if (node[n] & CLOSED) continue;
+            if (n != target && !map_walkable(nx, ny)) continue;
+            if (push(n, d, e.g + 1)) {
+                status = PATH_FAILED;                                           // open set full
+                break;
+            }
+        }
+    }
+    return status;
+}
+
+int path_length()
+{
+    if (status != PATH_FOUND) return -1;
+    int n = 0;
+    for (int t = target; t != start; n++) {
+        int d = node[t] & DIR_MASK;
+        t -= step_y[d] * w + step_x[d];
+    }
+    return n;
+}
+
+int path_get(int* xs, int* ys, int max)
+{
+    int n = path_length();
+    if (n < 0) return 0;
+    int t = target;
+    for (int i = n - 1; i >= 0; i--) {                                          // walk back from the target
+        if (i < max) {
+            xs[i] = t % w;
+            ys[i] = t / w;
+        }
+        int d = node[t] & DIR_MASK;
+        t -= step_y[d] * w + step_x[d];
+    }
+    return n < max ? n : max;
+}
+
+int path_find(int sx, int sy, int tx, int ty, int* dx, int* dy)
+{
+    path_begin(sx, sy, tx, ty);
+    while (path_step(PATH_MAX_AREA) == PATH_RUNNING);
+    int n = path_length();
+    if (n > 0) {
+        int x, y;
+        path_get(&x, &y, 1);
+        *dx = x - sx;
+        *dy = y - sy;
+    }
+    return n;
+}
+
+void path_bench(int searches)
+{
+    int width = map_width(), height = map_height();
+    unsigned seed = 1;
+    int found = 0, done = 0, dx, dy;
+    unsigned t0 = us_ticker_read();
+    while (done < searches) {
+        seed = seed * 1103515245 + 12345;
+        int sx = (seed >> 8) % width, sy = (seed >> 20) % height;
+        seed = seed * 1103515245 + 12345;
+        int tx = (seed >> 8) % width, ty = (seed >> 20) % height;
+        if (!map_walkable(sx, sy) || !map_walkable(tx, ty)) continue;
+        if (path_find(sx, sy, tx, ty, &dx, &dy) >= 0) found++;
+        done++;
+    }
+    unsigned us = us_ticker_read() - t0;
+    pc.printf("path_bench %dx%d: %d searches, %d found, %u us, %u per second\r\n",
+              width, height, searches, found, us, us ? (unsigned)((unsigned long long)searches * 1000000 / us) : 0);
+}
@@ -0,0 +1,56 @@
+#ifndef PATH_H
+#define PATH_H
+
+// Largest map area that can be searched (the 50x50 main map)
+#define PATH_MAX_AREA   2500
+
+// Capacity of the open set. A search that needs more fails with PATH_FAILED.
+#define PATH_OPEN_MAX   512
+
+// Search status, returned by path_step
+#define PATH_RUNNING    0
+#define PATH_FOUND      1
+#define PATH_FAILED     -1
+
+/**
+ * Start an A* search on the active map from (sx,sy) to (tx,ty), moving in
+ * the four compass directions over tiles where map_walkable is true. The
+ * target itself does not need to be walkable. There is one search in flight
+ * at a time; starting a new one abandons the old one. All storage is static,
+ * so no search ever calls malloc.
+ */
+void path_begin(int sx, int sy, int tx, int ty);
+
+/**
+ * Advance the current search by expanding at most max_nodes tiles. Call it
+ * again on later frames while it returns PATH_RUNNING to spread a long search
+ * over several frames.
+ */
+int path_step(int max_nodes);
+
+/**
+ * After PATH_FOUND, the number of moves from the start to the target.
+ */
+int path_length();
+
+/**
+ * After PATH_FOUND, store up to max tiles of the path, in order from the one
+ * after the start up to the target. Returns the number stored.
+ */
+int path_get(int* xs, int* ys, int max);
+
+/**
+ * Run a whole search at once. Returns the path length, or -1 if there is no
+ * path (or the open set overflowed). If there is a first move, it is stored
+ * in (dx,dy).
+ */
+int path_find(int sx, int sy, int tx, int ty, int* dx, int* dy);
+
+/**
+ * Time searches between pseudo-random walkable tiles of the active map and
+ * print the rate to the serial console. This runs on the board; the game has
+ * no host build, so the rate is only meaningful for the LPC1768.
+ */
+void path_bench(int searches);
+
+#endif // PATH_H
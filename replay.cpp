@@ -0,0 +1,158 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAGIC       "GIR1"
+#define FRAME_SIZE  4
+#define SCALE       64      // accelerometer units per g
+
+static FILE* file;
+static int mode;
+static int fast;
+static int finished;
+static int frames;
+static unsigned seed;
+static int fuzz_frames;
+
+static int open_file(const char* path, const char* how)
+{
+    replay_stop();
+    file = fopen(path, how);
+    return file ? 0 : -1;
+}
+
+int replay_record(const char* path)
+{
+    if (open_file(path, "wb")) return -1;
+    if (fwrite(MAGIC, 4, 1, file) != 1) {
+        replay_stop();
+        return -1;
+    }
+    mode = REPLAY_RECORD;
+    return 0;
+}
+
+int replay_play(const char* path, int f)
+{
+    if (open_file(path, "rb")) return -1;
+    char magic[4];
+    if (fread(magic, 4, 1, file) != 1 || memcmp(magic, MAGIC, 4)) {
+        replay_stop();
+        return -1;
+    }
+    mode = REPLAY_PLAY;
+    fast = f;
+    return 0;
+}
+
+void replay_fuzz(unsigned s, int n)
+{
+    replay_stop();
+    mode = REPLAY_FUZZ;
+    fast = 1;
+    seed = s;
+    fuzz_frames = n;
+}
+
+int replay_mode()
+{
+    return mode;
+}
+
+int replay_fast()
+{
+    return (mode == REPLAY_PLAY || mode == REPLAY_FUZZ) && fast;
+}
+
+int replay_finished()
+{
+    return finished;
+}
+
+int replay_frames()
+{
+    return frames;
+}
+
+void replay_stop()
+{
+    if (file) fclose(file);
+    file = NULL;
+    mode = REPLAY_OFF;
+    fast = 0;
+    finished = 0;
+    frames = 0;
+}
+
+static signed char quantize(double a)
+{
+    int q = (int)(a * SCALE + (a < 0 ? -0.5 : 0.5));
+    if (q > 127) q = 127;
+    if (q < -127) q = -127;
+    return q;
+}
+
+static void encode(const GameInputs& in, unsigned char* frame)
+{
+    frame[0] = (in.b1 ? 1 : 0) | (in.b2 ? 2 : 0) | (in.b3 ? 4 : 0) | (in.b4 ? 8 : 0);
+    frame[1] = quantize(in.ax);
+    frame[2] = quantize(in.ay);
+    frame[3] = quantize(in.az);
+}
+
+static GameInputs decode(const unsigned char* frame)
+{
+    GameInputs in;
+    in.b1 = frame[0] & 1;
+    in.b2 = (frame[0] >> 1) & 1;
+    in.b3 = (frame[0] >> 2) & 1;
+    in.b4 = (frame[0] >> 3) & 1;
+    in.ax = (double)(signed char)frame[1] / SCALE;
+    in.ay = (double)(signed char)frame[2] / SCALE;
+    in.az = (double)(signed char)frame[3] / SCALE;
+    return in;
+}
+
+/**
+ * One frame of random inputs. Each button is pressed on about 1 frame in 16
+ * (omni mode 1 in 256, as it changes so much), and the board is tilted in one
+ * of the four directions or held level.
+ */
+static void fuzz(unsigned char* frame)
+{
+    seed = seed * 1103515245 + 12345;
+    unsigned r = seed >> 8;
+    frame[0] = 0x0F;
+    if ((r & 0x0F) == 0) frame[0] &= ~1;                                        // action
+    if ((r & 0xF0) == 0) frame[0] &= ~8;                                        // waypoint
+    if (((r >> 8) & 0xFF) == 0) frame[0] &= ~2;                                 // omni
+    static const signed char tilt[5][2] = {{0, 0}, {SCALE, 0}, {-SCALE, 0}, {0, SCALE}, {0, -SCALE}};
+    int t = (r >> 16) % 5;
+    frame[1] = tilt[t][0];
+    frame[2] = tilt[t][1];
+    frame[3] = SCALE;
+}
+
+GameInputs replay_inputs()
+{
+    unsigned char frame[FRAME_SIZE];
+    if (mode == REPLAY_PLAY || mode == REPLAY_FUZZ) {
+        if (mode == REPLAY_FUZZ && frames < fuzz_frames) {
+            fuzz(frame);
+            frames++;
+        } else if (mode == REPLAY_PLAY && !finished && fread(frame, FRAME_SIZE, 1, file) == 1) {
+            frames++;
+        } else {
+            finished = 1;
+            static const unsigned char idle[FRAME_SIZE] = {0x0F, 0, 0, SCALE};
+            memcpy(frame, idle, FRAME_SIZE);
+        }
+        return decode(frame);
+    }
+    GameInputs in = read_inputs();
+    if (mode != REPLAY_RECORD) return in;
+    encode(in, frame);
+    if (fwrite(frame, FRAME_SIZE, 1, file) == 1 && ++frames % REPLAY_FLUSH == 0) fflush(file);
+    return decode(frame);                                                       // what a replay will see
+}
@@ -0,0 +1,79 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "hardware.h"
+
+/**
+ * Input recording and replay. While recording, every frame's GameInputs are
+ * appended to a file; a replay feeds the same frames back to the game loop in
+ * place of the hardware. The game has no other source of randomness, so a
+ * replay reproduces the recorded play-through exactly.
+ *
+ * File format: the 4 bytes "GIR1", then 4 bytes per frame: the buttons as
+ * bits 0-3 (b1-b4, set when the pin reads high), then ax, ay and az as signed
+ * bytes in units of 1/64 g. Inputs are rounded to this precision while
+ * recording too, so the live game sees exactly what a replay will.
+ */
+
+// Replay modes, returned by replay_mode
+#define REPLAY_OFF      0
+#define REPLAY_RECORD   1
+#define REPLAY_PLAY     2
+#define REPLAY_FUZZ     3
+
+// Recorded frames are flushed to the file this often, so a recording
+// survives the board being reset
+#define REPLAY_FLUSH    10
+
+/**
+ * Start recording to path, replacing the file. Returns 0 on success.
+ */
+int replay_record(const char* path);
+
+/**
+ * Start playing back path. With fast set, the game loop skips its frame
+ * delay and runs as fast as it can. Returns 0 on success.
+ */
+int replay_play(const char* path, int fast);
+
+/**
+ * Feed the game pseudo-random inputs instead of the hardware: mostly tilts,
+ * with the action, waypoint and omni buttons now and then. A given seed always
+ * produces the same inputs, so a failing run can be repeated. Finishes after
+ * the given number of frames, and always runs fast.
+ */
+void replay_fuzz(unsigned seed, int frames);
+
+/**
+ * Returns REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY or REPLAY_FUZZ.
+ */
+int replay_mode();
+
+/**
+ * Returns nonzero if the game loop should not wait between frames.
+ */
+int replay_fast();
+
+/**
+ * The inputs for the next frame: read from the file when playing back,
+ * generated when fuzzing, otherwise from read_inputs (and appended to the file when recording).
+ */
+GameInputs replay_inputs();
+
+/**
+ * Returns nonzero once a replay or fuzz run has run out of frames. replay_inputs then
+ * returns idle inputs (no buttons, level board).
+ */
+int replay_finished();
+
+/**
+ * Number of frames recorded or played back so far.
+ */
+int replay_frames();
+
+/**
+ * Stop recording or playing and close the file.
+ */
+void replay_stop();
+
+#endif // REPLAY_H
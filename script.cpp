@@ -0,0 +1,466 @@
+#include "script.h"
+
+#include "map.h"
+#include "speech.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Longest script line, including the terminator
+#define LINE_LEN    96
+
+// Marks the end of a rule chain in first[] and a rule's next offset
+#define NO_RULE     0xFFFF
+
+// Number of hash chains for portals; a power of two
+#define PORTAL_BUCKETS  16
+
+/**
+ * Opcodes. A rule compiles to
+ *   OP_RULE next:2  (OP_COND var cmp value:2 | OP_OR)*  OP_THEN  effect*  OP_END
+ * where next is the offset of the following rule for the same type. A portal
+ * is a rule with its tile after next, and a warp as its first effect:
+ *   OP_RULE next:2 map:2 x:2 y:2  conds  OP_THEN  OP_WARP map x y  effect*  OP_END
+ * where next is the offset of the following portal in the same hash chain.
+ * Numbers are 16-bit little-endian; strings are stored inline, NUL terminated.
+ */
+enum {
+    OP_RULE, OP_COND, OP_OR, OP_THEN, OP_END,
+    OP_SAY,         // line1 line2
+    OP_ERASE_HERE,
+    OP_ERASE,       // x y
+    OP_ADD,         // type x y
+    OP_SET,         // var value
+    OP_INC,         // var value
+    OP_PUSH,
+    OP_WARP,        // map x y
+    OP_HOOK,        // hook
+    OP_QUIET
+};
+
+enum { CMP_EQ, CMP_NE, CMP_LT, CMP_GT, CMP_LE, CMP_GE };
+
+static const char* const type_names[MAP_TYPES] = {
+    "TREE", "DUNGEONBRICK", "PLANT", "RIVER", NULL, "PORTAL", "NPC", "SLIME",
+    "GHOST", "GATE1", "GATE2", "FLAG", "KEY", "ROCK", "HEART"
+};
+
+static void (* const adders[MAP_TYPES])(int x, int y) = {
+    NULL, NULL, add_plant, NULL, NULL, add_portal, add_NPC, add_slime,
+    add_ghost, add_gate1, add_gate2, add_flag, add_key, add_rock, add_heart
+};
+
+static const char* const var_names[SCRIPT_VARS] = {
+    "progress", "key", "slimes", "omni", "map", "heart", "lives", "health", "x", "y"
+};
+
+static const char* const hud_names[SH_WIN] = {
+    "slimes", "noslimes", "lives", "health"
+};
+
+/**
+ * The compiled script. first[t] is the offset of the first rule for MapItem
+ * type t, so script_run goes straight to the rules that can apply, and
+ * portal_first[b] the first portal in hash chain b.
+ */
+static unsigned char code[SCRIPT_MAX];
+static int code_len;
+static unsigned short first[MAP_TYPES];
+static unsigned short portal_first[PORTAL_BUCKETS];
+
+static int unbound;
+static int* vars[SCRIPT_VARS];
+static void (*hooks[SCRIPT_HOOKS])();
+
+/**
+ * Compiler state, kept between lines: the rule being compiled (or -1), and
+ * the last rule compiled for each type and portal chain, whose next offset
+ * the following rule in the chain fills in.
+ */
+static int rule;
+static int last[MAP_TYPES];
+static int portal_last[PORTAL_BUCKETS];
+
+void script_bind(int v, int* p)
+{
+    if (v >= 0 && v < SCRIPT_VARS) vars[v] = p;
+}
+
+void script_hook(int h, void (*fn)())
+{
+    if (h >= 0 && h < SCRIPT_HOOKS) hooks[h] = fn;
+}
+
+static int get16(int at)
+{
+    return (short)(code[at] | (code[at+1] << 8));
+}
+
+static int emit(int b)
+{
+    if (code_len == SCRIPT_MAX) return -1;
+    code[code_len++] = b;
+    return 0;
+}
+
+static int emit16(int v)
+{
+    return emit(v & 0xFF) || emit((v >> 8) & 0xFF);
+}
+
+static int emit_str(const char* s)
+{
+    do {
+        if (emit(*s)) return -1;
+    } while (*s++);
+    return 0;
+}
+
+/**
+ * Copy the next token from *p into buf, advancing *p past it. A token is a run
+ * of non-blank characters or a "quoted string" (stored without the quotes).
+ * Returns 0 when the line has no more tokens.
+ */
+static int token(char** p, char* buf)
+{
+    char* s = *p;
+    while (*s == ' ' || *s == '\t') s++;
+    if (!*s || *s == '\r' || *s == '\n') return 0;
+    int n = 0;
+    if (*s == '"') {
+        for (s++; *s && *s != '"'; s++) buf[n++] = *s;
+        if (*s) s++;
+    } else {
+        for (; *s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n'; s++) buf[n++] = *s;
+    }
+    buf[n] = 0;
+    *p = s;
+    return 1;
+}
+
+/**
+ * The hash chain for the portal on tile (x,y) of map m.
+ */
+static int portal_bucket(int m, int x, int y)
+{
+    return (unsigned)((m * 251 + x) * 251 + y) % PORTAL_BUCKETS;
+}
+
+static int lookup(const char* const* names, int n, const char* s)
+{
+    for (int i = 0; i < n; i++) {
+        if (names[i] && !strcmp(names[i], s)) return i;
+    }
+    return -1;
+}
+
+static int number(const char* s, int* v)
+{
+    char* end;
+    *v = strtol(s, &end, 10);
+    return *s && !*end;
+}
+
+/**
+ * Compile "var<op>value", e.g. slimes<=5.
+ */
+static int compile_cond(char* s)
+{
+    char* op = s;
+    while (*op && !strchr("=!<>", *op)) op++;
+    char* val = op;
+    while (*val && strchr("=!<>", *val)) val++;
+    int cmp;
+    if (val - op == 1 && *op == '=') cmp = CMP_EQ;
+    else if (val - op == 1 && *op == '<') cmp = CMP_LT;
+    else if (val - op == 1 && *op == '>') cmp = CMP_GT;
+    else if (val - op == 2 && !strncmp(op, "!=", 2)) cmp = CMP_NE;
+    else if (val - op == 2 && !strncmp(op, "<=", 2)) cmp = CMP_LE;
+    else if (val - op == 2 && !strncmp(op, ">=", 2)) cmp = CMP_GE;
+    else return -1;
+    int n;
+    if (!number(val, &n)) return -1;
+    *op = 0;
+    int v = lookup(var_names, SCRIPT_VARS, s);
+    if (v < 0) return -1;
+    return emit(OP_COND) || emit(v) || emit(cmp) || emit16(n);
+}
+
+/**
+ * Start a rule, linking it onto the end of the chain whose head is *head and
+ * whose last rule is *tail.
+ */
+static int start_rule(unsigned short* head, int* tail)
+{
+    rule = code_len;
+    if (emit(OP_RULE) || emit16(NO_RULE)) return -1;
+    if (*tail < 0) *head = rule;
+    else {
+        code[*tail + 1] = rule & 0xFF;
+        code[*tail + 2] = rule >> 8;
+    }
+    *tail = rule;
+    return 0;
+}
+
+/**
+ * Compile the rest of a rule's first line: "cond... [or cond...]".
+ */
+static int compile_conds(char* p, char* tok)
+{
+    while (token(&p, tok)) {
+        if (!strcmp(tok, "or") ? emit(OP_OR) : compile_cond(tok)) return -1;
+    }
+    return emit(OP_THEN);
+}
+
+/**
+ * Compile "on TYPE cond... [or cond...]", linking the rule into its type's
+ * chain.
+ */
+static int compile_on(char* p, char* tok)
+{
+    if (!token(&p, tok)) return -1;
+    int type = lookup(type_names, MAP_TYPES, tok);
+    if (type < 0) return -1;
+    if (start_rule(&first[type], &last[type])) return -1;
+    return compile_conds(p, tok);
+}
+
+/**
+ * Compile "portal MAP x y to MAP x y cond... [or cond...]", linking the rule
+ * into the hash chain for its tile.
+ */
+static int compile_portal(char* p, char* tok)
+{
+    int at[3], to[3];
+    for (int i = 0; i < 3; i++) {
+        if (!token(&p, tok) || !number(tok, &at[i])) return -1;
+    }
+    if (!token(&p, tok) || strcmp(tok, "to")) return -1;
+    for (int i = 0; i < 3; i++) {
+        if (!token(&p, tok) || !number(tok, &to[i])) return -1;
+    }
+    int b = portal_bucket(at[0], at[1], at[2]);
+    if (start_rule(&portal_first[b], &portal_last[b])) return -1;
+    if (emit16(at[0]) || emit16(at[1]) || emit16(at[2]) || compile_conds(p, tok)) return -1;
+    return emit(OP_WARP) || emit16(to[0]) || emit16(to[1]) || emit16(to[2]);
+}
+
+/**
+ * Compile the numeric arguments of an effect.
+ */
+static int compile_numbers(char* p, char* tok, int n)
+{
+    int v;
+    while (n--) {
+        if (!token(&p, tok) || !number(tok, &v) || emit16(v)) return -1;
+    }
+    return token(&p, tok) ? -1 : 0;
+}
+
+static int compile_line(char* p)
+{
+    char tok[LINE_LEN];
+    char arg[LINE_LEN];
+    if (!token(&p, tok) || tok[0] == '#') return 0;                             // blank line or comment
+    if (!strcmp(tok, "on")) return rule < 0 ? compile_on(p, tok) : -1;
+    if (!strcmp(tok, "portal")) return rule < 0 ? compile_portal(p, tok) : -1;
+    if (rule < 0) return -1;                                                    // effects only inside a rule
+    if (!strcmp(tok, "end")) {
+        rule = -1;
+        return emit(OP_END);
+    }
+    if (!strcmp(tok, "say")) {
+        if (!token(&p, tok)) return -1;
+        if (!token(&p, arg)) arg[0] = 0;
+        return emit(OP_SAY) || emit_str(tok) || emit_str(arg);
+    }
+    if (!strcmp(tok, "erase")) {
+        char* q = p;
+        if (!token(&q, arg)) return emit(OP_ERASE_HERE);
+        return emit(OP_ERASE) || compile_numbers(p, tok, 2);
+    }
+    if (!strcmp(tok, "add")) {
+        int type = token(&p, tok) ? lookup(type_names, MAP_TYPES, tok) : -1;
+        if (type < 0 || !adders[type]) return -1;
+        return emit(OP_ADD) || emit(type) || compile_numbers(p, tok, 2);
+    }
+    if (!strcmp(tok, "set") || !strcmp(tok, "inc")) {
+        int op = tok[0] == 's' ? OP_SET : OP_INC;
+        int v = token(&p, tok) ? lookup(var_names, SCRIPT_VARS, tok) : -1;
+        if (v < 0 || emit(op) || emit(v)) return -1;
+        char* q = p;
+        if (op == OP_INC && !token(&q, arg)) return emit16(1);
+        return compile_numbers(p, tok, 1);
+    }
+    if (!strcmp(tok, "push")) return emit(OP_PUSH);
+    if (!strcmp(tok, "warp")) return emit(OP_WARP) || compile_numbers(p, tok, 3);
+    if (!strcmp(tok, "hud")) {
+        int h = token(&p, tok) ? lookup(hud_names, SH_WIN, tok) : -1;
+        return h < 0 ? -1 : emit(OP_HOOK) || emit(h);
+    }
+    if (!strcmp(tok, "win")) return emit(OP_HOOK) || emit(SH_WIN);
+    if (!strcmp(tok, "quiet")) return emit(OP_QUIET);
+    return -1;
+}
+
+static void reset()
+{
+    code_len = 0;
+    rule = -1;
+    for (int t = 0; t < MAP_TYPES; t++) {
+        first[t] = NO_RULE;
+        last[t] = -1;
+    }
+    for (int b = 0; b < PORTAL_BUCKETS; b++) {
+        portal_first[b] = NO_RULE;
+        portal_last[b] = -1;
+    }
+}
+
+/**
+ * Finish loading. On any error the script is left empty; a rule left open by
+ * a missing "end" is reported at the line after the last one.
+ */
+static int finish(int err)
+{
+    if (err) reset();
+    return err;
+}
+
+int script_load_text(const char* text)
+{
+    char line[LINE_LEN];
+    int n = 0;
+    reset();
+    while (*text) {
+        n++;
+        int len = strcspn(text, "\n");
+        if (len >= LINE_LEN) return finish(n);
+        memcpy(line, text, len);
+        line[len] = 0;
+        text += len;
+        if (*text) text++;
+        if (compile_line(line)) return finish(n);
+    }
+    return finish(rule >= 0 ? n + 1 : 0);
+}
+
+static int* var(int v)
+{
+    return vars[v] ? vars[v] : &unbound;
+}
+
+static int compare(int a, int cmp, int b)
+{
+    switch (cmp) {
+        case CMP_EQ: return a == b;
+        case CMP_NE: return a != b;
+        case CMP_LT: return a < b;
+        case CMP_GT: return a > b;
+        case CMP_LE: return a <= b;
+        default:     return a >= b;
+    }
+}
+
+/**
+ * Evaluate the conditions of a rule, which start at pc. Returns the offset of
+ * its first effect if they hold, or -1.
+ */
+static int match(int pc)
+{
+    int group = 1, any = 0;
+    while (1) {
+        switch (code[pc]) {
+            case OP_COND:
+                if (!compare(*var(code[pc+1]), code[pc+2], get16(pc+3))) group = 0;
+                pc += 5;
+                break;
+            case OP_OR:
+                any |= group;
+                group = 1;
+                pc++;
+                break;
+            default:                                                            // OP_THEN
+                return (any | group) ? pc + 1 : -1;
+        }
+    }
+}
+
+/**
+ * Run the effects from pc up to OP_END. (x,y) is the tile acted on.
+ */
+static int exec(int pc, int x, int y)
+{
+    int redraw = 1;
+    while (1) {
+        switch (code[pc]) {
+            case OP_SAY: {
+                const char* line1 = (const char*)&code[pc+1];
+                const char* line2 = line1 + strlen(line1) + 1;
+                speech(line1, line2);
+                pc = line2 + strlen(line2) + 1 - (const char*)code;
+                break;
+            }
+            case OP_ERASE_HERE:
+                map_clear(x, y);
+                pc++;
+                break;
+            case OP_ERASE:
+                map_clear(get16(pc+1), get16(pc+3));
+                pc += 5;
+                break;
+            case OP_ADD:
+                adders[code[pc+1]](get16(pc+2), get16(pc+4));
+                pc += 6;
+                break;
+            case OP_SET:
+                *var(code[pc+1]) = get16(pc+2);
+                pc += 4;
+                break;
+            case OP_INC:
+                *var(code[pc+1]) += get16(pc+2);
+                pc += 4;
+                break;
+            case OP_PUSH:                                                       // away from the player
+                if (!map_push(x, y, x - *var(SV_X), y - *var(SV_Y))) return 0;
+                pc++;
+                break;
+            case OP_WARP:
+                if (!set_active_map(get16(pc+1))) return redraw;                // no such map: stay put and skip the rest
+                *var(SV_MAP) = get16(pc+1);
+                *var(SV_X) = get16(pc+3);
+                *var(SV_Y) = get16(pc+5);
+                pc += 7;
+                break;
+            case OP_HOOK:
+                if (hooks[code[pc+1]]) hooks[code[pc+1]]();
+                pc += 2;
+                break;
+            case OP_QUIET:
+                redraw = 0;
+                pc++;
+                break;
+            default:                                                            // OP_END
+                return redraw;
+        }
+    }
+}
+
+int script_run(int type, int x, int y)
+{
+    if (!code_len) return 0;
+    int m = *var(SV_MAP);
+    for (int r = portal_first[portal_bucket(m, x, y)]; r != NO_RULE; r = (unsigned short)get16(r+1)) {
+        if (get16(r+3) != m || get16(r+5) != x || get16(r+7) != y) continue;  // another tile in the chain
+        int pc = match(r + 9);
+        if (pc >= 0) return exec(pc, x, y);
+    }
+    if (type < 0 || type >= MAP_TYPES) return 0;
+    for (int r = first[type]; r != NO_RULE; r = (unsigned short)get16(r+1)) {
+        int pc = match(r + 3);
+        if (pc >= 0) return exec(pc, x, y);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+/**
+ * Quest scripts. Interactions (pressing the action button next to a MapItem)
+ * are described by rules in a small text language, compiled once into a
+ * static bytecode buffer and interpreted without allocating. A rule is:
+ *
+ *   on TYPE [cond ...] [or cond ...]
+ *     effect
+ *     ...
+ *   end
+ *
+ * TYPE is a MapItem type name (NPC, ROCK, ...). A cond compares a variable to
+ * a number: progress=1, slimes<5, key!=0 (=, !=, <, >, <=, >=). Conditions in
+ * a group must all hold; "or" starts another group. A rule with no conditions
+ * always matches. The first matching rule for the type runs.
+ *
+ * A portal is a rule for one tile, whatever is on it, that moves the player to
+ * another map before its effects run:
+ *
+ *   portal MAP x y to MAP x y [cond ...] [or cond ...]
+ *     effect
+ *     ...
+ *   end
+ *
+ * Portals are kept in a small hash table by tile, and the first matching one
+ * for the tile acted on runs ahead of any rule for its type; so a quest can
+ * have any number of them, and using one checks only the few that share its
+ * hash chain.
+ *
+ * Effects:
+ *   say "line1" "line2"    show a speech bubble
+ *   erase [x y]            erase the tile acted on, or (x,y): the entity on it
+ *                          if there is one, otherwise its MapItem
+ *   add TYPE x y           add a MapItem, or an entity for NPC, SLIME, GHOST
+ *                          and ROCK
+ *   set VAR n / inc VAR [n]
+ *   push                   push the entity acted on one tile further, if free
+ *   warp MAP x y           move the player to (x,y) on another map; if there is
+ *                          no such map, the rest of the rule is skipped
+ *   hud NAME               redraw part of the status bar (see SH_*)
+ *   win                    the game is won
+ *   quiet                  don't redraw the screen afterwards
+ *
+ * Lines starting with # are comments.
+ */
+
+// Script variables; bind each to game state with script_bind
+#define SV_PROGRESS 0   // progress
+#define SV_KEY      1   // key
+#define SV_SLIMES   2   // slimes
+#define SV_OMNI     3   // omni
+#define SV_MAP      4   // map
+#define SV_HEART    5   // heart
+#define SV_LIVES    6   // lives
+#define SV_HEALTH   7   // health
+#define SV_X        8   // x
+#define SV_Y        9   // y
+#define SCRIPT_VARS 10
+
+// Game functions scripts can call; register each with script_hook
+#define SH_SLIMES   0   // hud slimes
+#define SH_NOSLIMES 1   // hud noslimes
+#define SH_LIVES    2   // hud lives
+#define SH_HEALTH   3   // hud health
+#define SH_WIN      4   // win
+#define SCRIPT_HOOKS 5
+
+// Size of the compiled script buffer, in bytes
+#define SCRIPT_MAX  2048
+
+/**
+ * Make script variable v read and write *p.
+ */
+void script_bind(int v, int* p);
+
+/**
+ * Make hook h call fn.
+ */
+void script_hook(int h, void (*fn)());
+
+/**
+ * Compile a script from text, replacing any script already loaded. Returns 0
+ * on success, or the number of the first bad line (the script is then empty).
+ */
+int script_load_text(const char* text);
+
+/**
+ * Run the first portal for the tile (x,y) on the map in the "map" variable
+ * whose conditions hold, or failing that the first such rule for MapItem
+ * type, acting on the tile (x,y). Returns 1 if a rule ran and the screen
+ * needs a full redraw, 0 otherwise.
+ */
+int script_run(int type, int x, int y);
+
+#endif // SCRIPT_H
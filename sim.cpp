@@ -0,0 +1,101 @@
+#include "sim.h"
+
+#include "globals.h"
+
+static int headless;
+static int stopped;
+static const char* reason;
+static long frames;
+static unsigned t0, elapsed;
+static long allocs, allocs0;
+
+#ifdef SIM_COUNT_ALLOCS
+extern "C" {
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t n);
+
+void* __wrap_malloc(size_t n)
+{
+    allocs++;
+    return __real_malloc(n);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    allocs++;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t n)
+{
+    allocs++;
+    return __real_realloc(p, n);
+}
+}
+#endif
+
+/**
+ * Microseconds from an arbitrary start point. Differences stay correct when
+ * the ticker wraps, every 71 minutes.
+ */
+static unsigned now_us()
+{
+    return us_ticker_read();
+}
+
+void sim_start(int h)
+{
+    headless = h;
+    stopped = 0;
+    reason = NULL;
+    frames = 0;
+    allocs0 = allocs;
+    t0 = now_us();
+}
+
+int sim_headless()
+{
+    return headless;
+}
+
+void sim_frame()
+{
+    frames++;
+}
+
+void sim_stop(const char* why)
+{
+    if (stopped) return;
+    elapsed = now_us() - t0;
+    stopped = 1;
+    reason = why;
+}
+
+int sim_stopped()
+{
+    return stopped;
+}
+
+long sim_allocs()
+{
+#ifdef SIM_COUNT_ALLOCS
+    return allocs - allocs0;
+#else
+    return -1;
+#endif
+}
+
+void sim_report()
+{
+    unsigned us = stopped ? elapsed : now_us() - t0;
+    unsigned fps = us ? (unsigned)((unsigned long long)frames * 1000000 / us) : 0;
+    pc.printf("sim: %s after %ld frames, %u us, %u frames/s",
+              reason ? reason : "running", frames, us, fps);
+    long a = sim_allocs();
+    if (a >= 0) {
+        long per100 = frames ? a * 100 / frames : 0;
+        pc.printf(", %ld allocations (%ld.%02ld per frame)", a, per100 / 100, per100 % 100);
+    }
+    pc.printf("\r\n");
+}
@@ -0,0 +1,53 @@
+#ifndef SIM_H
+#define SIM_H
+
+/**
+ * Run statistics for the game loop, and headless mode. A headless run (build
+ * with -DHEADLESS and -DREPLAY_FROM) plays back a recording with no drawing,
+ * speech bubbles or frame delay, to measure the game logic alone or to push
+ * thousands of frames through a quest. When the run stops it reports frames
+ * per second and heap allocations per frame. The game only builds for the
+ * board, so these are LPC1768 figures, printed on the serial console.
+ *
+ * Allocations are counted only in builds with -DSIM_COUNT_ALLOCS, linked with
+ *   -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+ */
+
+/**
+ * Start a run, resetting the counters. With headless set, draw_game, the
+ * status bars, the omni icon and speech do nothing.
+ */
+void sim_start(int headless);
+
+/**
+ * Returns nonzero during a headless run.
+ */
+int sim_headless();
+
+/**
+ * Count one game frame.
+ */
+void sim_frame();
+
+/**
+ * End the run, giving the reason for the report.
+ */
+void sim_stop(const char* why);
+
+/**
+ * Returns nonzero once sim_stop has been called.
+ */
+int sim_stopped();
+
+/**
+ * Heap allocations since sim_start, or -1 if they are not being counted.
+ */
+long sim_allocs();
+
+/**
+ * Print the frame count, frames per second and allocations per frame to the
+ * serial console.
+ */
+void sim_report();
+
+#endif // SIM_H
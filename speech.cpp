@@ -1,4 +1,5 @@
 #include "speech.h"
+#include "sim.h"
 
 #include "globals.h"
 #include "hardware.h"
@@ -51,6 +52,7 @@ void speech_bubble_wait()
 
 void speech(const char* line1, const char* line2)                               // uses bottom portion of map area to display 2 lines of text at a time
 {
+    if(sim_headless()) return;                                                  // nothing to show in a headless run
     draw_speech_bubble();                                                       // make room for bubble
     draw_speech_line(line1, TOP);                                               // print line1
     draw_speech_line(line2, BOTTOM);                                            // print line2